@@ -0,0 +1,233 @@
+/* batchbench.c - throughput of szlib on many small messages
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* The file is cut into messages of the same size, each of which is
+* compressed to a stream of its own:
+*   stream  one szip_compress_init (blocksize the message size)/
+*           szip_compress_stream/szip_end per message
+*   batch   szip_compress_batch on one thread, and on -t threads if given
+* Every message is decoded again and compared. The best of several
+* repetitions is reported as microseconds per message and MB/s of input.
+* -P gives a profile (szip --learn) for all of them.
+*
+* usage: batchbench [-s<msgsize>] [-o<order>] [-t<threads>] [-n<reps>]
+*                   [-P<profile>] file
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "szlib.h"
+
+static double now(void)
+{   struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+
+static void usage(void)
+{   fprintf(stderr, "usage: batchbench [-s<msgsize>] [-o<order>] [-t<threads>] [-n<reps>]\n"
+        "                  [-P<profile>] file\n");
+    exit(1);
+}
+
+
+/* messages and their coded form */
+static size_t nmsg, *inlen, *outcap, *outlen;
+static const unsigned char **in;
+static unsigned char **out;
+static int order = 6;
+static szip_profile *profile = NULL;
+
+
+static void perstream(void)
+{   size_t i, avail;
+    const unsigned char *p;
+    unsigned char *o;
+    szip_stream *s;
+    for (i=0; i<nmsg; i++)
+    {   s = szip_compress_init(inlen[i], order, 1);
+        szip_set_profile(s, profile);
+        p = in[i];
+        avail = inlen[i];
+        o = out[i];
+        outlen[i] = outcap[i];
+        if (s == NULL || szip_compress_stream(s, &p, &avail, &o, &outlen[i],
+            SZIP_FINISH) != SZIP_END)
+        {   fprintf(stderr, "stream compression of message %lu failed\n", (unsigned long)i);
+            exit(1);
+        }
+        outlen[i] = o - out[i];
+        szip_end(s);
+    }
+}
+
+
+/* decode every message and compare */
+static void verify(void)
+{   size_t i, avail, cap;
+    const unsigned char *p;
+    unsigned char *o, *buf = (unsigned char*) malloc(inlen[0]+1);
+    szip_stream *s;
+    for (i=0; i<nmsg; i++)
+    {   s = szip_decompress_init();
+        szip_set_profile(s, profile);
+        p = out[i];
+        avail = outlen[i];
+        o = buf;
+        cap = inlen[0]+1;
+        if (s == NULL || szip_decompress_stream(s, &p, &avail, &o, &cap, SZIP_FINISH)
+            != SZIP_END || (size_t)(o-buf) != inlen[i] || memcmp(buf, in[i], inlen[i]))
+        {   fprintf(stderr, "message %lu does not decode\n", (unsigned long)i);
+            exit(1);
+        }
+        szip_end(s);
+    }
+    free(buf);
+}
+
+
+static void report(char *name, double t, size_t total)
+{   size_t i, coded = 0;
+    for (i=0; i<nmsg; i++)
+        coded += outlen[i];
+    printf("%-10s %8.1f us/message %8.2f MB/s  %5.3f bpc\n", name, t*1e6/nmsg,
+        total/t/1e6, 8.0*coded/total);
+}
+
+
+static void batch(int threads, int reps, char *name, size_t total)
+{   double start, best = 1e30;
+    int r;
+    for (r=0; r<reps; r++)
+    {   start = now();
+        if (szip_compress_batch(nmsg, in, inlen, out, outcap, outlen, order, 1, profile,
+            threads)
+            != SZIP_OK)
+        {   fprintf(stderr, "batch compression failed\n");
+            exit(1);
+        }
+        if (now()-start < best)
+            best = now()-start;
+    }
+    verify();
+    report(name, best, total);
+}
+
+
+int main(int argc, char **argv)
+{   size_t msgsize = 4096, total, i;
+    int threads = 0, reps = 3, r;
+    unsigned char *data;
+    char *file = NULL, *profilefile = NULL, name[20];
+    double start, best;
+    FILE *f;
+
+    for (i=1; i<(size_t)argc; i++)
+    {   char *a = argv[i];
+        if (a[0] != '-')
+            file = a;
+        else if (a[1] == 's')
+            msgsize = strtoul(a+2, NULL, 10);
+        else if (a[1] == 'o')
+            order = atoi(a+2);
+        else if (a[1] == 't')
+            threads = atoi(a+2);
+        else if (a[1] == 'n')
+            reps = atoi(a+2);
+        else if (a[1] == 'P')
+            profilefile = a+2;
+        else
+            usage();
+    }
+    if (file == NULL || msgsize == 0 || reps < 1)
+        usage();
+    if (profilefile != NULL)
+    {   unsigned char buf[4096];
+        size_t n;
+        f = fopen(profilefile, "rb");
+        if (f == NULL)
+        {   perror(profilefile);
+            exit(1);
+        }
+        n = fread(buf, 1, sizeof(buf), f);
+        fclose(f);
+        profile = szip_profile_load(buf, n);
+        if (profile == NULL)
+        {   fprintf(stderr, "%s is no szip profile\n", profilefile);
+            exit(1);
+        }
+    }
+    f = fopen(file, "rb");
+    if (f == NULL)
+    {   perror(file);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    total = ftell(f);
+    rewind(f);
+    data = (unsigned char*) malloc(total+1);
+    if (data == NULL || fread(data, 1, total, f) != total)
+    {   fprintf(stderr, "cannot read %s\n", file);
+        exit(1);
+    }
+    fclose(f);
+    if (total < msgsize)
+        msgsize = total;
+    nmsg = total / msgsize;
+    total = nmsg * msgsize;
+    in = (const unsigned char**) malloc(nmsg*sizeof(unsigned char*));
+    out = (unsigned char**) malloc(nmsg*sizeof(unsigned char*));
+    inlen = (size_t*) malloc(nmsg*sizeof(size_t));
+    outcap = (size_t*) malloc(nmsg*sizeof(size_t));
+    outlen = (size_t*) malloc(nmsg*sizeof(size_t));
+    if (in == NULL || out == NULL || inlen == NULL || outcap == NULL || outlen == NULL)
+    {   fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i=0; i<nmsg; i++)
+    {   in[i] = data + i*msgsize;
+        inlen[i] = msgsize;
+        outcap[i] = szip_bound(msgsize);
+        out[i] = (unsigned char*) malloc(outcap[i]);
+        if (out[i] == NULL)
+        {   fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    printf("%lu messages of %lu bytes, order %d\n", (unsigned long)nmsg,
+        (unsigned long)msgsize, order);
+
+    best = 1e30;
+    for (r=0; r<reps; r++)
+    {   start = now();
+        perstream();
+        if (now()-start < best)
+            best = now()-start;
+    }
+    verify();
+    report("stream", best, total);
+
+    batch(1, reps, "batch 1", total);
+    if (threads != 1)
+    {   sprintf(name, threads ? "batch %d" : "batch all", threads);
+        batch(threads, reps, name, total);
+    }
+    return 0;
+}
@@ -65,6 +65,7 @@ static Inline void build_cf(bitmodel *m)
 /* scales the culmulative frequency tables by 0.5 and keeps nonzero values */
 static void scalefreq(bitmodel *m)
 {   uint2 *f, *endf;
+    STATCOUNT(m->rescales++);
     for (f=m->f, endf = f+m->n; f<endf; f++)
 #ifdef EXCLUDEONUPDATE
         *f = ((1+(*f & 0x7fff))>>1) | (*f & 0x8000);
@@ -90,6 +91,7 @@ void initbitmodel( bitmodel *m, int n, int max_totf, int rescale,
     if (m->incr < 1) m->incr = 1;
     m->f = (uint2*) malloc(n*sizeof(uint2));
     m->cf = (uint2*) malloc((n+1)*sizeof(uint2));
+    STATCOUNT(m->rescales = 0);
     m->mask = 1;
     while (n>>=1)
         m->mask <<=1;
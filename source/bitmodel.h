@@ -49,6 +49,9 @@ typedef struct {
         mask;          /* initial bitmask used for search */
     uint2 *f,          /* frequency for the symbol; first bit set if excluded */
         *cf;           /* array of cumulative frequencies */
+#ifdef SZSTATS
+    uint4 rescales;    /* number of rescales */
+#endif
 } bitmodel;
 
 /* initialisation of bitmodel                          */
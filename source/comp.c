@@ -1,10 +1,41 @@
+#define _FILE_OFFSET_BITS 64  /* seeking in large archives */
 #define GLOBALRANGECODER
 #define MODELGLOBAL
 
+#include <stdio.h>
+
+#ifdef unix
+/* stdin and stdout are used by the main thread only (the threads of */
+/* --async copy between file descriptors), so they need no locking    */
+#undef getchar
+#undef putchar
+#undef putc
+#define getchar() getchar_unlocked()
+#define putchar(c) putchar_unlocked(c)
+#define putc(c,f) putc_unlocked(c,f)
+#endif
+
+/* the decoder reads from memory while rcin is set (szip -t) */
+unsigned char *rcin=NULL, *rcinend;
+/* the encoder writes to memory while rcout is set; bytes beyond */
+/* rcoutsize are only counted                                     */
+unsigned char *rcout=NULL;
+unsigned long rcoutpos, rcoutsize;
+#define outbyte(cod,x) (rcout==NULL ? putchar(x) : \
+    (rcoutpos<rcoutsize ? rcout[rcoutpos]=(x) : 0, rcoutpos++))
+#define inbyte(cod)    (rcin==NULL ? getchar() : rcin<rcinend ? *rcin++ : EOF)
+
 #include "rangecod.c"
 #include "qsmodel.c"
+#ifdef VECMODEL
+#include "vecmodel.c"
+#else
 #include "bitmodel.c"
+#endif
 #include "sz_mod4.c"
 #include "szip.c"
+#include "szarc.c"
+#include "szio.c"
 #include "sz_srt.c"
+#include "sz_hash.c"
 #include "reorder.c"
@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #define uint2 u_int16_t
 #define uint4 u_int32_t
+#define uint8 u_int64_t
 /* uint is alredy defined in types.h */
 
 #else
@@ -25,8 +26,26 @@ typedef unsigned long  uint4;
 #endif /* INT_MAX */
 
 typedef unsigned int uint;     /* fast unsigned integer, 2 or 4 bytes  */
+typedef unsigned long long uint8; /* file positions and sizes        */
 
 #endif
 
 
+/* with SZ_THREADS (szlib.c) a THREADLOCAL static belongs to the */
+/* calling thread                                                 */
+#if defined SZ_THREADS && defined _MSC_VER
+#define THREADLOCAL __declspec(thread)
+#elif defined SZ_THREADS
+#define THREADLOCAL __thread
+#else
+#define THREADLOCAL
+#endif
+
+/* SZSTATS compiles in the statistics counters (see sz_mod4.h) */
+#ifdef SZSTATS
+#define STATCOUNT(x) x
+#else
+#define STATCOUNT(x)
+#endif
+
 #endif
@@ -29,10 +29,15 @@
 #include "qsmodel.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* default tablesize 1<<TBLSHIFT */
 #define TBLSHIFT 7
 
+/* models with at most 256 symbols and a total frequency of at most */
+/* 1<<LUTSHIFT decode with a direct symbol table instead of search  */
+#define LUTSHIFT 12
+
 /* rescale frequency counts */
 static void dorescale( qsmodel *m)
 {   int i, cf, missing;
@@ -47,6 +52,7 @@ static void dorescale( qsmodel *m)
         if (m->rescale > m->targetrescale)
             m->rescale = m->targetrescale;
     }
+    STATCOUNT(m->rescales++);
     cf = missing = m->cf[m->n];  /* do actual rescaling */
     for(i=m->n-1; i; i--)
     {   int tmp = m->newf[i];
@@ -66,7 +72,11 @@ static void dorescale( qsmodel *m)
     m->incr = missing / m->rescale;
     m->nextleft = missing % m->rescale;
     m->left = m->rescale - m->nextleft;
-    if (m->search != NULL)
+    if (m->symtab != NULL)
+    {   for (i=0; i<m->n; i++)
+            memset(m->symtab + m->cf[i], i, m->cf[i+1] - m->cf[i]);
+    }
+    else if (m->search != NULL)
     {   i=m->n;
         while (i)
         {   int start, end;
@@ -99,8 +109,15 @@ void initqsmodel( qsmodel *m, int n, int lg_totf, int rescale, int *init, int co
     m->newf = (uint2*) malloc((n+1)*sizeof(uint2));
     m->cf[n] = 1<<lg_totf;
     m->cf[0] = 0;
+    STATCOUNT(m->rescales = 0);
+    m->search = NULL;
+    m->symtab = NULL;
     if (compress)
-        m->search = NULL;
+        /* void */;
+    else if (n <= 256 && lg_totf <= LUTSHIFT)
+    {   m->symtab = (unsigned char*) malloc((1<<lg_totf)+1);
+        m->symtab[1<<lg_totf] = n-1;
+    }
     else
     {   m->search = (uint2*) malloc(((1<<TBLSHIFT)+1)*sizeof(uint2));
         m->search[1<<TBLSHIFT] = n-1;
@@ -136,6 +153,8 @@ void deleteqsmodel( qsmodel *m )
     free(m->newf);
     if (m->search != NULL)
         free(m->search);
+    if (m->symtab != NULL)
+        free(m->symtab);
 }
 
 
@@ -156,6 +175,8 @@ void qsgetfreq( qsmodel *m, int sym, int *sy_f, int *lt_f )
 int qsgetsym( qsmodel *m, int lt_f )
 {   int lo, hi;
     uint2 *tmp;
+    if (m->symtab != NULL)
+        return m->symtab[lt_f];
     tmp = m->search+(lt_f>>m->searchshift);
     lo = *tmp;
     hi = *(tmp+1) + 1;
@@ -170,6 +191,25 @@ int qsgetsym( qsmodel *m, int lt_f )
 }
 
 
+/* find out symbol and its frequencies for a given     */
+/* cumulative frequency (qsgetsym and qsgetfreq in one) */
+/* m   qsmodel to be questioned                        */
+/* cul  cumulative frequency                           */
+/* sy_f frequency of the returned symbol               */
+/* lt_f frequency of all smaller symbols together      */
+int qsgetsymfreq( qsmodel *m, int cul, int *sy_f, int *lt_f )
+{   int sym;
+    uint2 *cf;
+    if (m->symtab != NULL)
+        sym = m->symtab[cul];
+    else
+        sym = qsgetsym(m, cul);
+    cf = m->cf + sym;
+    *sy_f = cf[1] - (*lt_f = cf[0]);
+    return sym;
+}
+
+
 /* update model                                        */
 /* m   qsmodel to be updated                           */
 /* sym  symbol that occurred (must be <n from init)    */
@@ -41,6 +41,10 @@ typedef struct {
     uint2 *cf,         /* array of cumulative frequencies */
         *newf,         /* array for collecting ststistics */
         *search;       /* structure for searching on decompression */
+    unsigned char *symtab; /* symbol for each lt_freq (small models only) */
+#ifdef SZSTATS
+    uint4 rescales;    /* number of rescales */
+#endif
 } qsmodel;
 
 /* initialisation of qsmodel                           */
@@ -78,6 +82,15 @@ void qsgetfreq( qsmodel *m, int sym, int *sy_f, int *lt_f );
 int qsgetsym( qsmodel *m, int lt_f );
 
 
+/* find out symbol and its frequencies for a given     */
+/* cumulative frequency (qsgetsym and qsgetfreq in one) */
+/* m   qsmodel to be questioned                        */
+/* cul  cumulative frequency                           */
+/* sy_f frequency of the returned symbol               */
+/* lt_f frequency of all smaller symbols together      */
+int qsgetsymfreq( qsmodel *m, int cul, int *sy_f, int *lt_f );
+
+
 /* update model                                        */
 /* m   qsmodel to be updated                           */
 /* sym  symbol that occurred (must be <n from init)    */
@@ -88,8 +88,11 @@
 /* all IO is done by these macros - change them if you want to */
 /* no checking is done - do it here if you want it             */
 /* cod is a pointer to the used rangecoder                     */
+/* they may also be defined before including this file         */
+#ifndef outbyte
 #define outbyte(cod,x) putchar(x)
 #define inbyte(cod)    getchar()
+#endif
 
 
 #ifdef RENORM95
@@ -142,6 +145,7 @@ void start_encoding( rangecoder *rc, char c, int initlength )
     RNGC.buffer = c;
     RNGC.help = 0;               /* No bytes to follow */
     RNGC.bytecount = initlength;
+    STATCOUNT(RNGC.renorms = 0);
 }
 
 
@@ -172,6 +176,7 @@ static Inline void enc_normalize( rangecoder *rc )
         RNGC.range <<= 8;
         RNGC.low = (RNGC.low<<8) & (Top_value-1);
         RNGC.bytecount++;
+        STATCOUNT(RNGC.renorms++);
     }
 }
 #endif
@@ -257,6 +262,8 @@ int start_decoding( rangecoder *rc )
     RNGC.buffer = M_inbyte;
     RNGC.low = RNGC.buffer >> (8-EXTRA_BITS);
     RNGC.range = (code_value)1 << EXTRA_BITS;
+    RNGC.bytecount = 2;
+    STATCOUNT(RNGC.renorms = 0);
     return c;
 }
 
@@ -267,6 +274,8 @@ static Inline void dec_normalize( rangecoder *rc )
         RNGC.buffer = M_inbyte;
         RNGC.low |= RNGC.buffer >> (8-EXTRA_BITS);
         RNGC.range <<= 8;
+        RNGC.bytecount++;
+        STATCOUNT(RNGC.renorms++);
     }
 }
 #endif
@@ -339,6 +348,17 @@ unsigned short decode_short(rangecoder *rc)
 
 /* Finish decoding                                           */
 /* rc is the range coder to be used                          */
-void done_decoding( rangecoder *rc )
+/* the return value is the number of bytes read              */
+uint4 done_decoding( rangecoder *rc )
 {   dec_normalize(rc);      /* normalize to use up all bytes */
+    return RNGC.bytecount;
+}
+
+
+#ifdef SZSTATS
+/* Number of bytes moved by renormalisation since start      */
+/* rc is the range coder to be used                          */
+uint4 renorm_count( rangecoder *rc )
+{   return RNGC.renorms;
 }
+#endif
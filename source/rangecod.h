@@ -51,7 +51,10 @@
 #define rangecod_h
 
 
+/* SZ_THREADS (szlib.c) needs one coder per thread */
+#ifndef SZ_THREADS
 #define GLOBALRANGECODER
+#endif
 
 
 #include "port.h"
@@ -86,6 +89,15 @@ typedef struct {
 /* the following is used only when encoding */
     uint4 bytecount;     /* counter for outputed bytes  */
 /* insert fields you need for input/output below this line! */
+#ifdef SZ_THREADS
+    unsigned char *out,  /* memory IO of szlib.c, see there */
+                  *in, *inend;
+    uint4 outpos, outsize;
+    int inover;
+#endif
+#ifdef SZSTATS
+    uint4 renorms;       /* bytes shifted out resp. in by normalisation */
+#endif
 } rangecoder;
 
 
@@ -103,6 +115,7 @@ typedef struct {
 #define decode_byte(rc) M_decode_byte()
 #define decode_short(rc) M_decode_short()
 #define done_decoding(rc) M_done_decoding()
+#define renorm_count(rc) M_renorm_count()
 #endif
 
 
@@ -164,6 +177,13 @@ unsigned short decode_short(rangecoder *rc);
 
 /* Finish decoding                                           */
 /* rc is the range coder to be used                          */
-void done_decoding( rangecoder *rc );
+/* returns number of bytes read                              */
+uint4 done_decoding( rangecoder *rc );
+
+#ifdef SZSTATS
+/* Number of bytes moved by renormalisation since start      */
+/* rc is the range coder to be used                          */
+uint4 renorm_count( rangecoder *rc );
+#endif
 
 #endif
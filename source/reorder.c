@@ -1,15 +1,450 @@
+#include <stdlib.h>
+#include <string.h>
 #include "port.h"
+#include "reorder.h"
+#if defined __SSE2__
+#include <emmintrin.h>
+#endif
+/* recordsize 3 needs pshufb (SSSE3): with gcc it is compiled for SSSE3 */
+/* in any case and taken if the processor has it                       */
+#if defined __SSSE3__
+#include <tmmintrin.h>
+#define SSSE3_TARGET
+#define HAVE_SSSE3 1
+#elif defined __SSE2__ && defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#include <tmmintrin.h>
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#define HAVE_SSSE3 __builtin_cpu_supports("ssse3")
+#endif
 
-void reorder(unsigned char *in, unsigned char *out, uint4 length, uint recordsize)
-{	uint4 i,j;
+/* reorder makes the columns of the records contiguous: column i (byte i */
+/* of every record) has q = length/recordsize bytes, one more if i is    */
+/* below the rest of length. Both directions take the records in order   */
+/* in one pass: recordsizes 2, 4 and 8 16 records at a time with SSE2, 3 */
+/* with SSSE3, the others and the last records in                        */
+/* chunks of RECCHUNK bytes, so the columns written stay in the cache.   */
+
+#define RECCHUNK 0x2000
+
+static Inline uint4 colstart(uint4 q, uint4 rest, uint i)
+{	return i*q + (i < rest ? i : rest);
+}
+
+/* records from..q-1 to the columns */
+static void gather(unsigned char *in, unsigned char *out, uint4 q, uint4 rest,
+	uint recordsize, uint4 from)
+{	uint4 k, end, step = RECCHUNK/recordsize + 1;
+	uint i;
+	for (; from<q; from=end)
+	{	end = q-from > step ? from+step : q;
+		for (i=0; i<recordsize; i++)
+		{	unsigned char *c = out + colstart(q, rest, i), *p = in+from*recordsize+i;
+			for (k=from; k<end; k++, p+=recordsize)
+				c[k] = *p;
+		}
+	}
+}
+
+/* the columns to records from..q-1 */
+static void scatter(unsigned char *in, unsigned char *out, uint4 q, uint4 rest,
+	uint recordsize, uint4 from)
+{	uint4 k, end, step = RECCHUNK/recordsize + 1;
+	uint i;
+	for (; from<q; from=end)
+	{	end = q-from > step ? from+step : q;
+		for (i=0; i<recordsize; i++)
+		{	unsigned char *c = in + colstart(q, rest, i), *p = out+from*recordsize+i;
+			for (k=from; k<end; k++, p+=recordsize)
+				*p = c[k];
+		}
+	}
+}
+
+
+#if defined __SSE2__
+#define LOAD(p) _mm_loadu_si128((__m128i*)(p))
+#define STORE(p,v) _mm_storeu_si128((__m128i*)(p), v)
+
+/* the even and the odd bytes of the 32 bytes a,b */
+static Inline void split2(__m128i a, __m128i b, __m128i *even, __m128i *odd)
+{	__m128i low = _mm_set1_epi16(0xff);
+	*even = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+	*odd = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+static Inline void merge2(__m128i even, __m128i odd, __m128i *a, __m128i *b)
+{	*a = _mm_unpacklo_epi8(even, odd);
+	*b = _mm_unpackhi_epi8(even, odd);
+}
+
+/* 16 records of 4 bytes v[0..3] to their columns c[0..3] and back */
+static Inline void split4(__m128i *v, __m128i *c)
+{	__m128i e0, o0, e1, o1;
+	split2(v[0], v[1], &e0, &o0);
+	split2(v[2], v[3], &e1, &o1);
+	split2(e0, e1, c, c+2);
+	split2(o0, o1, c+1, c+3);
+}
+
+static Inline void merge4(__m128i *c, __m128i *v)
+{	__m128i e0, o0, e1, o1;
+	merge2(c[0], c[2], &e0, &e1);
+	merge2(c[1], c[3], &o0, &o1);
+	merge2(e0, o0, v, v+1);
+	merge2(e1, o1, v+2, v+3);
+}
+
+#if defined HAVE_SSSE3
+/* lane l of column c takes byte 3l+c, which is in vector (3l+c)/16 */
+#define G3(c,s,l) ((3*(l)+(c))/16 == (s) ? 3*(l)+(c)-16*(s) : -1)
+#define G3V(c,s) _mm_setr_epi8(G3(c,s,0), G3(c,s,1), G3(c,s,2), G3(c,s,3), \
+	G3(c,s,4), G3(c,s,5), G3(c,s,6), G3(c,s,7), G3(c,s,8), G3(c,s,9), \
+	G3(c,s,10), G3(c,s,11), G3(c,s,12), G3(c,s,13), G3(c,s,14), G3(c,s,15))
+#define GATHER3(v,c) _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v[0], G3V(c,0)), \
+	_mm_shuffle_epi8(v[1], G3V(c,1))), _mm_shuffle_epi8(v[2], G3V(c,2)))
+/* lane t of vector s is byte 16s+t, lane (16s+t)/3 of column (16s+t)%3 */
+#define S3(s,c,t) ((16*(s)+(t))%3 == (c) ? (16*(s)+(t))/3 : -1)
+#define S3V(s,c) _mm_setr_epi8(S3(s,c,0), S3(s,c,1), S3(s,c,2), S3(s,c,3), \
+	S3(s,c,4), S3(s,c,5), S3(s,c,6), S3(s,c,7), S3(s,c,8), S3(s,c,9), \
+	S3(s,c,10), S3(s,c,11), S3(s,c,12), S3(s,c,13), S3(s,c,14), S3(s,c,15))
+#define SCATTER3(c,s) _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(c[0], S3V(s,0)), \
+	_mm_shuffle_epi8(c[1], S3V(s,1))), _mm_shuffle_epi8(c[2], S3V(s,2)))
+
+SSSE3_TARGET static uint4 gather3(unsigned char *in, unsigned char **c, uint4 q)
+{	__m128i v[3];
+	uint4 k;
+	for (k=0; k+16<=q; k+=16, in+=48)
+	{	v[0] = LOAD(in); v[1] = LOAD(in+16); v[2] = LOAD(in+32);
+		STORE(c[0]+k, GATHER3(v, 0));
+		STORE(c[1]+k, GATHER3(v, 1));
+		STORE(c[2]+k, GATHER3(v, 2));
+	}
+	return k;
+}
+
+SSSE3_TARGET static uint4 scatter3(unsigned char **c, unsigned char *out, uint4 q)
+{	__m128i x[3];
+	uint4 k;
+	for (k=0; k+16<=q; k+=16, out+=48)
+	{	x[0] = LOAD(c[0]+k); x[1] = LOAD(c[1]+k); x[2] = LOAD(c[2]+k);
+		STORE(out, SCATTER3(x, 0));
+		STORE(out+16, SCATTER3(x, 1));
+		STORE(out+32, SCATTER3(x, 2));
+	}
+	return k;
+}
+#endif
+
+/* records 0..returned-1 to the columns; 0 if recordsize has no kernel */
+static uint4 gathersimd(unsigned char *in, unsigned char *out, uint4 q, uint4 rest,
+	uint recordsize)
+{	unsigned char *c[8];
+	__m128i v[8], e[4], o[4], x[4];
+	uint4 k = 0;
+	uint i;
+	if (recordsize > 8)
+		return 0;
 	for (i=0; i<recordsize; i++)
-		for(j=i; j<length; j+=recordsize)
-			*(out++) = in[j];
+		c[i] = out + colstart(q, rest, i);
+	switch (recordsize)
+	{	case 2:
+			for (; k+16<=q; k+=16, in+=32)
+			{	split2(LOAD(in), LOAD(in+16), x, x+1);
+				STORE(c[0]+k, x[0]);
+				STORE(c[1]+k, x[1]);
+			}
+			break;
+#if defined HAVE_SSSE3
+		case 3:
+			if (HAVE_SSSE3)
+				k = gather3(in, c, q);
+			break;
+#endif
+		case 4:
+			for (; k+16<=q; k+=16, in+=64)
+			{	for (i=0; i<4; i++)
+					v[i] = LOAD(in+16*i);
+				split4(v, x);
+				for (i=0; i<4; i++)
+					STORE(c[i]+k, x[i]);
+			}
+			break;
+		case 8:	/* the even bytes are columns 0,2,4,6 as records of 4, the odd ones 1,3,5,7 */
+			for (; k+16<=q; k+=16, in+=128)
+			{	for (i=0; i<4; i++)
+					split2(LOAD(in+32*i), LOAD(in+32*i+16), e+i, o+i);
+				split4(e, x);
+				for (i=0; i<4; i++)
+					STORE(c[2*i]+k, x[i]);
+				split4(o, x);
+				for (i=0; i<4; i++)
+					STORE(c[2*i+1]+k, x[i]);
+			}
+			break;
+	}
+	return k;
 }
 
-void unreorder(unsigned char *in, unsigned char *out, uint4 length, uint recordsize)
-{	uint4 i,j;
+/* columns to records 0..returned-1, the reverse of gathersimd */
+static uint4 scattersimd(unsigned char *in, unsigned char *out, uint4 q, uint4 rest,
+	uint recordsize)
+{	unsigned char *c[8];
+	__m128i v[8], e[4], o[4], x[4];
+	uint4 k = 0;
+	uint i;
+	if (recordsize > 8)
+		return 0;
 	for (i=0; i<recordsize; i++)
-		for(j=i; j<length; j+=recordsize)
-			out[j] = *(in++);
+		c[i] = in + colstart(q, rest, i);
+	switch (recordsize)
+	{	case 2:
+			for (; k+16<=q; k+=16, out+=32)
+			{	merge2(LOAD(c[0]+k), LOAD(c[1]+k), v, v+1);
+				STORE(out, v[0]);
+				STORE(out+16, v[1]);
+			}
+			break;
+#if defined HAVE_SSSE3
+		case 3:
+			if (HAVE_SSSE3)
+				k = scatter3(c, out, q);
+			break;
+#endif
+		case 4:
+			for (; k+16<=q; k+=16, out+=64)
+			{	for (i=0; i<4; i++)
+					x[i] = LOAD(c[i]+k);
+				merge4(x, v);
+				for (i=0; i<4; i++)
+					STORE(out+16*i, v[i]);
+			}
+			break;
+		case 8:
+			for (; k+16<=q; k+=16, out+=128)
+			{	for (i=0; i<4; i++)
+					x[i] = LOAD(c[2*i]+k);
+				merge4(x, e);
+				for (i=0; i<4; i++)
+					x[i] = LOAD(c[2*i+1]+k);
+				merge4(x, o);
+				for (i=0; i<4; i++)
+				{	merge2(e[i], o[i], v, v+1);
+					STORE(out+32*i, v[0]);
+					STORE(out+32*i+16, v[1]);
+				}
+			}
+			break;
+	}
+	return k;
+}
+#endif
+
+
+void reorder(unsigned char *in, unsigned char *out, uint4 length, uint recordsize)
+{	uint4 q = length/recordsize, rest = length%recordsize, k = 0;
+	uint i;
+#if defined __SSE2__
+	k = gathersimd(in, out, q, rest, recordsize);
+#endif
+	gather(in, out, q, rest, recordsize, k);
+	for (i=0; i<rest; i++)
+		out[colstart(q, rest, i)+q] = in[q*recordsize+i];
+}
+
+void unreorder(unsigned char *in, unsigned char *out, uint4 length, uint recordsize)
+{	uint4 q = length/recordsize, rest = length%recordsize, k = 0;
+	uint i;
+#if defined __SSE2__
+	k = scattersimd(in, out, q, rest, recordsize);
+#endif
+	scatter(in, out, q, rest, recordsize, k);
+	for (i=0; i<rest; i++)
+		out[q*recordsize+i] = in[colstart(q, rest, i)+q];
+}
+
+/* the differences of 16 bytes at a time: each lane minus the lane */
+/* before, the first minus the last byte of the previous 16         */
+void makedelta(unsigned char *buf, uint4 length)
+{	unsigned char tmp = *buf;
+	uint4 i = 1;
+#if defined __SSE2__
+	{	__m128i prev = _mm_slli_si128(_mm_cvtsi32_si128(tmp), 15), v;
+		for (; i+16<=length; i+=16)
+		{	v = LOAD(buf+i);
+			STORE(buf+i, _mm_sub_epi8(v, _mm_or_si128(_mm_slli_si128(v, 1),
+				_mm_srli_si128(prev, 15))));
+			prev = v;
+		}
+		tmp = (unsigned char)_mm_cvtsi128_si32(_mm_srli_si128(prev, 15));
+	}
+#endif
+	for (; i<length; i++)
+	{	unsigned char tmp1 = buf[i];
+		buf[i] = (0x100 + tmp1 - tmp) & 0xff;
+		tmp = tmp1;
+	}
+}
+
+/* the prefix sums of 16 bytes in 4 shifted adds, plus the last sum */
+/* of the previous 16 in every lane                                 */
+void undodelta(unsigned char *buf, uint4 length)
+{	unsigned char c = *buf;
+	uint4 i = 1;
+#if defined __SSE2__
+	{	__m128i sum = _mm_set1_epi8((char)c), v;
+		for (; i+16<=length; i+=16)
+		{	v = LOAD(buf+i);
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+			v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+			v = _mm_add_epi8(v, sum);
+			STORE(buf+i, v);
+			/* the last byte in every lane */
+			sum = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_unpackhi_epi8(v, v), 0xff), 0xff);
+		}
+		c = buf[i-1];
+	}
+#endif
+	for (; i<length; i++)
+	{	c = (c+buf[i])&0xff;
+		buf[i] = c;
+	}
+}
+
+
+#define GUESSMAXRS 16       /* largest recordsize tried */
+#define GUESSCHUNK 0x2000   /* large blocks are sampled in chunks of this size */
+#define GUESSCHUNKS 4
+#define GUESSMARGIN 0x4000  /* 1/4 bit: a recordsize >1 must gain that much */
+
+/* log2(x) in 16.16 fixed point, linear between the powers of 2 */
+static uint4 fixlog2(uint4 x)
+{	uint4 e = 0;
+	while (x >> (e+1))
+		e++;
+	return e<<16 | (uint4)((((uint8)x<<16) >> e) & 0xffff);
+}
+
+/* order 0 entropy in bits per symbol, 16.16 fixed point */
+static uint4 entropy0(uint4 *counts, uint4 n)
+{	uint8 sum = 0;
+	uint4 i;
+	for (i=0; i<256; i++)
+		if (counts[i])
+			sum += (uint8)counts[i] * fixlog2(counts[i]);
+	return n ? fixlog2(n) - (uint4)(sum/n) : 8<<16;
+}
+
+unsigned char guessrecordsize(unsigned char *buf, uint4 length)
+{	uint4 counts[256], raw[256], h[GUESSMAXRS+1], n, chunk, nchunks,
+		start, end, i, r, best;
+	if (length < 4*GUESSMAXRS)
+		return 1;
+	nchunks = length > GUESSCHUNK*GUESSCHUNKS ? GUESSCHUNKS : 1;
+	memset(raw, 0, 256*sizeof(uint4));
+	for (r=0; r<=GUESSMAXRS; r++)
+	{	memset(counts, 0, 256*sizeof(uint4));
+		n = 0;
+		for (chunk=0; chunk<nchunks; chunk++)
+		{	if (nchunks == 1)
+			{	start = 0;
+				end = length;
+			} else
+			{	start = (uint4)((uint8)(length-GUESSCHUNK)*chunk/(GUESSCHUNKS-1));
+				end = start + GUESSCHUNK;
+			}
+			if (r == 0)		/* the bytes themselves */
+				for (i=start; i<end; i++)
+					raw[buf[i]]++;
+			else
+				for (i=start+r; i<end; i++)
+					counts[(buf[i]-buf[i-r]) & 0xff]++;
+			n += end-start-r;
+		}
+		h[r] = entropy0(r ? counts : raw, n);	/* h[0]: the bytes */
+	}
+	best = 1;
+	for (r=2; r<=GUESSMAXRS; r++)
+		if (h[r] < h[best])
+			best = r;
+	if (h[best]+GUESSMARGIN > h[1])
+		best = 1;
+	return (unsigned char)(best | (h[best] < h[0] ? 0x80 : 0));
+}
+
+
+#define RANDOMLIMIT 0.1     /* bits per byte order 0 or 1 must save */
+#define RANDOMREPEAT 64     /* repeats in 1/64 of the block are worth sorting */
+#define RANDOMSTEP 32       /* distance of the positions kept for repeats */
+#define RANDOMLAGS 8        /* order 1 is also tried on the byte lag back */
+#define LN2 0.6931471805599453
+
+/* The savings of an order 0 or order 1 model on data that is nearly */
+/* uniform are about chi^2/(2n ln 2) bits per byte, where chi^2 is   */
+/* taken against the uniform distribution (in each context) and     */
+/* reduced by its expected value for random data. Records (images,  */
+/* audio) hide from order 1 on the previous byte, so the byte up to  */
+/* RANDOMLAGS back is tried as context as well.                      */
+int incompressible(sz_workspace *w, unsigned char *buf, uint4 length)
+{	uint4 counts[256], *table, *pairs, *pos, i, j, c, k, covered, lag;
+	double chi, sq, n=length;
+
+	if (length < 0x1000)
+		return 0;
+	memset(counts, 0, 256*sizeof(uint4));
+	for (i=0; i<length; i++)
+		counts[buf[i]]++;
+	sq = 0;
+	for (c=0; c<256; c++)
+		sq += (double)counts[c]*counts[c];
+	chi = sq*256/n - n - 255;
+	if (chi/(2*n*LN2) >= RANDOMLIMIT)
+		return 0;
+
+	table = (uint4*) sz_workget(w, SZW_PAIRS, 2*0x10000*sizeof(uint4));
+	pairs = table;
+	for (lag=1; lag<=RANDOMLAGS; lag++)
+	{	memset(pairs, 0, 0x10000*sizeof(uint4));
+		for (i=lag; i<length; i++)
+			pairs[buf[i-lag]<<8 | buf[i]]++;
+		chi = 0;
+		for (c=0; c<256; c++)
+		{	uint4 *p = pairs + (c<<8), nc = 0;
+			sq = 0;
+			for (j=0; j<256; j++)
+			{	nc += p[j];
+				sq += (double)p[j]*p[j];
+			}
+			if (nc)
+				chi += sq*256/nc - nc - 255;
+		}
+		if (chi/(2*(n-lag)*LN2) >= RANDOMLIMIT)
+			return 0;
+	}
+
+	/* long repeats: every RANDOMSTEP-th position is kept in a hash */
+	/* table, so a repeat of RANDOMSTEP+7 bytes or more is found    */
+	pos = table + 0x10000;
+	memset(pos, 0, 0x10000*sizeof(uint4));
+	covered = 0;
+	for (i=0; i+8<=length; )
+	{	uint8 x;
+		memcpy(&x, buf+i, 8);
+		k = (uint4)((x * 0x9e3779b97f4a7c15ULL) >> 48);
+		j = pos[k];
+		if (j && memcmp(buf+j-1, buf+i, 8) == 0)
+		{	for (c=8; i+c<length && buf[j-1+c]==buf[i+c]; c++)
+				;
+			covered += c;
+			if (covered >= length/RANDOMREPEAT)
+				return 0;
+			i += c;
+			continue;
+		}
+		if (i % RANDOMSTEP == 0)
+			pos[k] = i+1;
+		i++;
+	}
+	return 1;
 }
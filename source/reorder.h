@@ -1,5 +1,29 @@
+#ifndef REORDER_H
+#define REORDER_H
+
 #include "port.h"
+#include "sz_srt.h"
 
 void reorder(unsigned char *in, unsigned char *out, uint4 length, uint recordsize);
 
+/* the decoders leave this and undodelta to sz_unsrt, which does both */
+/* while it writes the unsorted bytes                                */
 void unreorder(unsigned char *in, unsigned char *out, uint4 length, uint recordsize);
+
+/* replace each byte by its difference to the previous byte (-i) */
+void makedelta(unsigned char *buf, uint4 length);
+
+/* undo makedelta */
+void undodelta(unsigned char *buf, uint4 length);
+
+/* recordsize (1-16) and delta flag (0x80) that probably suit buf best: */
+/* the stride whose byte differences have the lowest order 0 entropy   */
+/* on a sample; delta if the differences beat the bytes themselves    */
+unsigned char guessrecordsize(unsigned char *buf, uint4 length);
+
+/* 1 if neither an order 0 nor an order 1 model gains much on buf */
+/* and it has no long repeats: sorting it would be a waste of time; */
+/* its tables are kept in w                                         */
+int incompressible(sz_workspace *w, unsigned char *buf, uint4 length);
+
+#endif
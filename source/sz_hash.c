@@ -0,0 +1,114 @@
+/*  sz_hash.c   block hashes for szip -c
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* SHA-256 as in FIPS 180-4 and the gear hash of sz_cutblock, see
+* sz_hash.h.
+*/
+
+#include <string.h>
+#include "sz_hash.h"
+
+#define ROTR(x,n) ((x)>>(n) | (x)<<(32-(n)))
+
+static const uint4 sha256k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+/* one 64 byte chunk into the state s */
+static void sha256chunk(uint4 *s, const unsigned char *p)
+{   uint4 w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+    for (i=0; i<16; i++, p+=4)
+        w[i] = (uint4)p[0]<<24 | (uint4)p[1]<<16 | (uint4)p[2]<<8 | p[3];
+    for (i=16; i<64; i++)
+        w[i] = w[i-16] + (ROTR(w[i-15],7) ^ ROTR(w[i-15],18) ^ w[i-15]>>3) +
+            w[i-7] + (ROTR(w[i-2],17) ^ ROTR(w[i-2],19) ^ w[i-2]>>10);
+    a = s[0]; b = s[1]; c = s[2]; d = s[3];
+    e = s[4]; f = s[5]; g = s[6]; h = s[7];
+    for (i=0; i<64; i++)
+    {   t1 = h + (ROTR(e,6) ^ ROTR(e,11) ^ ROTR(e,25)) + ((e & f) ^ (~e & g)) +
+            sha256k[i] + w[i];
+        t2 = (ROTR(a,2) ^ ROTR(a,13) ^ ROTR(a,22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+void sz_sha256(const unsigned char *data, uint4 len, unsigned char hash[SZ_HASHSIZE])
+{   uint4 s[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char last[128];
+    uint8 bits = (uint8)len << 3;
+    uint4 i, rest = len & 63;
+    int k;
+    for (i=0; i+64<=len; i+=64)
+        sha256chunk(s, data+i);
+    /* the rest, 0x80, zeros and the length in bits fill one or two chunks */
+    memset(last, 0, sizeof(last));
+    memcpy(last, data+i, rest);
+    last[rest] = 0x80;
+    i = rest < 56 ? 64 : 128;
+    for (k=0; k<8; k++)
+        last[i-1-k] = (unsigned char)(bits >> 8*k);
+    sha256chunk(s, last);
+    if (i == 128)
+        sha256chunk(s, last+64);
+    for (k=0; k<32; k++)
+        hash[k] = (unsigned char)(s[k>>2] >> (24 - 8*(k&3)));
+}
+
+
+/* gear values: fixed, since they decide where the blocks end */
+static uint4 gear[256];
+
+static void makegear(void)
+{   uint4 x = 0x9e3779b9;
+    int i;
+    for (i=0; i<256; i++)
+    {   x ^= x << 13;   /* xorshift32 */
+        x ^= x >> 17;
+        x ^= x << 5;
+        gear[i] = x;
+    }
+}
+
+uint4 sz_cutblock(const unsigned char *data, uint4 len, uint4 min, uint bits)
+{   uint4 h = 0, mask, i;
+    if (gear[0] == 0)
+        makegear();
+    if (len <= min)
+        return len;
+    mask = ~(uint4)0 << (32-bits);
+    /* the 32 bytes before min fill the hash, so the end depends on */
+    /* the content only                                              */
+    for (i = min > 32 ? min-32 : 0; i < min; i++)
+        h = (h << 1) + gear[data[i]];
+    for (; i<len; i++)
+    {   h = (h << 1) + gear[data[i]];
+        if ((h & mask) == 0)
+            return i+1;
+    }
+    return len;
+}
@@ -0,0 +1,37 @@
+/*  sz_hash.h   block hashes for szip -c
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* sz_sha256 names the content of a block: a block of a reference file
+* with the same hash is taken as is (--reference), so it must not
+* collide by chance. sz_cutblock finds content defined block ends with
+* a gear hash (a rolling hash over the last 32 bytes), so that inserting
+* or deleting bytes moves only the ends of the blocks near the change.
+*/
+#ifndef SZ_HASH_H
+#define SZ_HASH_H
+#include "port.h"
+
+#define SZ_HASHSIZE 32
+
+void sz_sha256(const unsigned char *data, uint4 len, unsigned char hash[SZ_HASHSIZE]);
+
+/* the length of the first block of the len bytes of data: the first   */
+/* end after min bytes where the rolling hash has its top bits zero,   */
+/* len if there is none. bits is about log2 of the bytes after min     */
+uint4 sz_cutblock(const unsigned char *data, uint4 len, uint4 min, uint bits);
+
+#endif
@@ -65,6 +65,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>   /* exit() */
+#include <string.h>   /* memset() */
 #include "sz_mod4.h"
 
 #define RLSHIFT 10
@@ -80,7 +81,8 @@ sz_model mod;
 #define finishupdate(m,a) M_finishupdate(a)
 #define addtomtf(m,a) M_addtomtf(a)
 #define encodeother(m,a) M_encodeother(a)
-#define readrunlength(m) M_readrun()
+#define readrun(m,a,b) M_readrun(a,b)
+#define writerun(m,a,b) M_writerun(a,b)
 #define activatenext(m,a) M_activatenext(a)
 #define MOD mod
 #else
@@ -217,7 +219,7 @@ static void addtomtf(sz_model *m, uint sym)
     }
     else if (MOD.mtfsizeact==MOD.mtfsize)   /* occupied by active symbol */
     {   MOD.lastseen[MOD.mtfhist[i].sym] = FULLFLAG;
-        bitreactivate(&(MOD.full),MOD.mtfhist[i].sym);
+        fullreactivate(&(MOD.full),MOD.mtfhist[i].sym);
     }
     else                                    /* occupied by inactive symbol*/
         MOD.mtfsizeact++;
@@ -273,12 +275,14 @@ static unsigned char encodeother(sz_model *m, uint sym)
                 goto found;
             last = i;
             i = MOD.mtfhist[i].next;
+            STATCOUNT(MOD.stats.mtfsteps++);
         }
         /* we didn't find it, so move all remaining active symbols to inactive */
         for (; n<MOD.mtfsizeact; n++)
         {   MOD.lastseen[MOD.mtfhist[i].sym] = FULLFLAG;
-            bitreactivate(&(MOD.full),MOD.mtfhist[i].sym);
+            fullreactivate(&(MOD.full),MOD.mtfhist[i].sym);
             i = MOD.mtfhist[i].next;
+            STATCOUNT(MOD.stats.mtfsteps++);
         }
         MOD.mtfsizeact = MTFSIZE;
     }
@@ -288,19 +292,21 @@ static unsigned char encodeother(sz_model *m, uint sym)
                 goto found;
             last = i;
             i = MOD.mtfhist[i].next;
+            STATCOUNT(MOD.stats.mtfsteps++);
         }
         /* we didn't find it, so try to make more active */
         MOD.mtfsizeact = MOD.mtfsize>MTFSIZE ? MTFSIZE : MOD.mtfsize;
         while (n<MOD.mtfsizeact)
         {   if (MOD.lastseen[MOD.mtfhist[i].sym]==FULLFLAG)
             {   MOD.lastseen[MOD.mtfhist[i].sym] = MTFFLAG;
-                bitdeactivate(&(MOD.full),MOD.mtfhist[i].sym);
+                fulldeactivate(&(MOD.full),MOD.mtfhist[i].sym);
                 if (MOD.mtfhist[i].sym == sym)
                 {   MOD.mtfsizeact = n+1;
                     goto found;
                 }
                 last = i;
                 i = MOD.mtfhist[i].next;
+                STATCOUNT(MOD.stats.mtfsteps++);
                 n++;
             }
             else /* symbol in cache or active MTF; remove from list */
@@ -309,6 +315,7 @@ static unsigned char encodeother(sz_model *m, uint sym)
                 else MOD.mtffirst = next;
                 MOD.mtfhist[i].next = 0xffff;
                 i = next;
+                STATCOUNT(MOD.stats.mtfsteps++);
                 MOD.mtfsize--;
                 if (MOD.mtfsizeact > MOD.mtfsize)
                     MOD.mtfsizeact = MOD.mtfsize;
@@ -318,15 +325,17 @@ static unsigned char encodeother(sz_model *m, uint sym)
     /* we didn't find it, so use full model */
     encode_shift(&(MOD.ac), MOD.whatmod[2], MOD.whatmod[0]+MOD.whatmod[1], 6);
     MOD.whatmod[2]+=6;
+    STATCOUNT(MOD.stats.what[2]++);
   { int sy_f, lt_f;
-    bitgetfreq(&(MOD.full),sym,&sy_f, &lt_f);
-    encode_freq(&(MOD.ac),sy_f,lt_f,bittotf(&(MOD.full)));
-    bitupdate_ex(&(MOD.full),sym);
+    fullgetfreq(&(MOD.full),sym,&sy_f, &lt_f);
+    encode_freq(&(MOD.ac),sy_f,lt_f,fulltotf(&(MOD.full)));
+    fullupdate_ex(&(MOD.full),sym);
     return 2;
   }
 found: /* we found it in MTF, so encode it and remove it */
     encode_shift(&(MOD.ac), MOD.whatmod[1], MOD.whatmod[0], 6);
     MOD.whatmod[1]+=6;
+    STATCOUNT(MOD.stats.what[1]++; MOD.stats.mtfrank[n]++);
   { int sy_f, lt_f;
     qsgetfreq(&(MOD.mtfmod), n, &sy_f, &lt_f);
     encode_shift(&(MOD.ac), sy_f, lt_f, MTFSHIFT);
@@ -342,12 +351,12 @@ found: /* we found it in MTF, so encode it and remove it */
     return 1;
 }
 
-static unsigned char readrun(qsmodel *rlmod, uint4 *n)
+static unsigned char readrun(sz_model *m, qsmodel *rlmod, uint4 *n)
 {   int sy_f, lt_f, rl;
-    rl = qsgetsym( rlmod, decode_culshift( &(MOD.ac), RLSHIFT));
-    qsgetfreq( rlmod, rl, &sy_f, &lt_f );
+    rl = qsgetsymfreq( rlmod, decode_culshift( &(MOD.ac), RLSHIFT), &sy_f, &lt_f );
     decode_update_shift(&(MOD.ac), sy_f, lt_f, RLSHIFT);
     qsupdate( rlmod, rl);
+    STATCOUNT(MOD.stats.runclass[rl]++);
     if (rl<=3)   /* no extra bits */
     {   rl++;
         *n = rl;
@@ -382,12 +391,13 @@ static unsigned char readrun(qsmodel *rlmod, uint4 *n)
 
 
 /* writes out the runlength */
-static unsigned char writerun(qsmodel *rlmod, uint4 n)
+static unsigned char writerun(sz_model *m, qsmodel *rlmod, uint4 n)
 {   int sy_f, lt_f;
 	if (n<=4)       /* no extra bits */
     {   qsgetfreq( rlmod, n-1, &sy_f, &lt_f );
         encode_shift( &(MOD.ac), (freq)sy_f, (freq)lt_f, RLSHIFT);
         qsupdate( rlmod, n-1);
+        STATCOUNT(MOD.stats.runclass[n-1]++);
         return (1 + (n>>1));
     }
     if (n<=8)       /* two extra bits */
@@ -395,6 +405,7 @@ static unsigned char writerun(qsmodel *rlmod, uint4 n)
         encode_shift( &(MOD.ac), (freq)sy_f, (freq)lt_f, RLSHIFT);
         encode_shift( &(MOD.ac), (freq)1, (freq)(n-5), 2);
         qsupdate( rlmod, 4);
+        STATCOUNT(MOD.stats.runclass[4]++);
 	    return 3;
     }
     if (n<=16)      /* three extra bits */
@@ -402,6 +413,7 @@ static unsigned char writerun(qsmodel *rlmod, uint4 n)
         encode_shift( &(MOD.ac), (freq)sy_f, (freq)lt_f, RLSHIFT);
         encode_shift( &(MOD.ac), (freq)1, (freq)(n-9), 3);
         qsupdate( rlmod, 5);
+        STATCOUNT(MOD.stats.runclass[5]++);
 	    return 4;
     }
 	qsgetfreq( rlmod, 6, &sy_f, &lt_f );
@@ -416,6 +428,7 @@ static unsigned char writerun(qsmodel *rlmod, uint4 n)
 	    encode_shift( &(MOD.ac), (freq)1, (freq)(n-((uint4)1<<i)), i);
 	}
 	qsupdate( rlmod, 6);
+    STATCOUNT(MOD.stats.runclass[6]++);
 	return 4;
 }
 
@@ -429,17 +442,19 @@ void sz_encode(sz_model *m, uint symbol, uint4 runlength)
         cacheptr old;
         encode_shift(&(MOD.ac), MOD.whatmod[0], 0, 6);
         MOD.whatmod[0]+=6;
+        STATCOUNT(MOD.stats.what[0]++);
         old = tmp;
         lt_f = 0;
         tmp = tmp->next;
         while (tmp != MOD.newest)
         {   lt_f += tmp->sy_f;
             tmp = tmp->next;
+            STATCOUNT(MOD.stats.cachesteps++);
         }
         encode_freq(&(MOD.ac), old->sy_f, lt_f, MOD.cachetotf - tmp->sy_f);
         tmp = tmp->next;
         tmp->what = 0;
-        tmp->weight = writerun(MOD.rlemod + old->weight, runlength);
+        tmp->weight = writerun(m, MOD.rlemod + old->weight, runlength);
         tmp->sy_f = tmp->weight + old->sy_f;
         old->sy_f = 0;
         MOD.newest = tmp;
@@ -447,11 +462,11 @@ void sz_encode(sz_model *m, uint symbol, uint4 runlength)
     else
     {   tmp = MOD.newest->next;
         tmp->what = encodeother(m,symbol);
-        tmp->weight = writerun(MOD.rlemod, runlength);
+        tmp->weight = writerun(m, MOD.rlemod, runlength);
         tmp->sy_f = tmp->weight;
         MOD.newest = tmp;
     }
-    finishupdate(M,symbol);
+    finishupdate(m,symbol);
 }
 
 
@@ -460,7 +475,7 @@ static int activatenext(sz_model *m, uint *next)
     {   mtfentry *tmp;
         tmp = MOD.mtfhist + *next;
         if (MOD.lastseen[tmp->sym]==FULLFLAG)
-        {   bitdeactivate(&(MOD.full),tmp->sym);
+        {   fulldeactivate(&(MOD.full),tmp->sym);
             MOD.lastseen[tmp->sym] = MTFFLAG;
             MOD.mtfsizeact++;
             return 1;
@@ -468,6 +483,7 @@ static int activatenext(sz_model *m, uint *next)
         *next = tmp->next;
         tmp->next = 0xffff;
         MOD.mtfsize--;
+        STATCOUNT(MOD.stats.mtfsteps++);
     }
     return 0;
 }
@@ -483,6 +499,7 @@ void sz_decode(sz_model *m, uint *symbol, uint4 *runlength)
         cacheptr tmp;
         decode_update_shift(&(MOD.ac), MOD.whatmod[0], 0, 6);
         MOD.whatmod[0] += 6;
+        STATCOUNT(MOD.stats.what[0]++);
         tmp = MOD.newest;
         tot_f = MOD.cachetotf - tmp->sy_f;
         sym = decode_culfreq( &(MOD.ac), tot_f);
@@ -491,12 +508,13 @@ void sz_decode(sz_model *m, uint *symbol, uint4 *runlength)
         while (lt_f <= sym)
         {   tmp = tmp->prev;
             lt_f += tmp->sy_f;
+            STATCOUNT(MOD.stats.cachesteps++);
         }
         decode_update(&(MOD.ac), tmp->sy_f, lt_f-tmp->sy_f, tot_f);
       { cacheptr free = MOD.newest->next;
         MOD.newest = free;
         free->what = 0;
-        free->weight = readrun(MOD.rlemod + tmp->weight, runlength);
+        free->weight = readrun(m, MOD.rlemod + tmp->weight, runlength);
         free->sy_f = free->weight + tmp->sy_f;
       }
         tmp->sy_f = 0;
@@ -507,10 +525,11 @@ void sz_decode(sz_model *m, uint *symbol, uint4 *runlength)
         uint sy_f, lt_f;
         decode_update_shift(&(MOD.ac), MOD.whatmod[1], MOD.whatmod[0], 6);
         MOD.whatmod[1] += 6;
-        sym = qsgetsym( &(MOD.mtfmod), decode_culshift( &(MOD.ac), MTFSHIFT));
-        qsgetfreq( &(MOD.mtfmod), sym, &sy_f, &lt_f );
+        sym = qsgetsymfreq( &(MOD.mtfmod), decode_culshift( &(MOD.ac), MTFSHIFT),
+            &sy_f, &lt_f );
         decode_update_shift(&(MOD.ac), sy_f, lt_f, MTFSHIFT);
         qsupdate( &(MOD.mtfmod), sym);
+        STATCOUNT(MOD.stats.what[1]++; MOD.stats.mtfrank[sym]++);
         if (MOD.mtfsizeact == 0)
             activatenext(&MOD,&(MOD.mtffirst));
 
@@ -528,13 +547,18 @@ void sz_decode(sz_model *m, uint *symbol, uint4 *runlength)
             mtfentry *target;
             if (sym < MOD.mtfsizeact) /* active list is large enough */
                 for (n=sym-1; n; n--) /* skip unneeded part of MTF */
-                    pred = MOD.mtfhist + pred->next;
+                {   pred = MOD.mtfhist + pred->next;
+                    STATCOUNT(MOD.stats.mtfsteps++);
+                }
             else
             {   for (n=MOD.mtfsizeact-1; n; n--) /* skip active part of MTF */
-                    pred = MOD.mtfhist + pred->next;
+                {   pred = MOD.mtfhist + pred->next;
+                    STATCOUNT(MOD.stats.mtfsteps++);
+                }
                 while (MOD.mtfsizeact<sym)
                 {   activatenext(&MOD,&(pred->next));
                     pred = MOD.mtfhist + pred->next;
+                    STATCOUNT(MOD.stats.mtfsteps++);
                 }
                 activatenext(&MOD,&(pred->next));
             }
@@ -548,7 +572,7 @@ void sz_decode(sz_model *m, uint *symbol, uint4 *runlength)
       { cacheptr free = MOD.newest->next;
         MOD.newest = free;
         free->what = 1;
-        free->weight = readrun(MOD.rlemod, runlength);
+        free->weight = readrun(m, MOD.rlemod, runlength);
         free->sy_f = free->weight;
       }
         *symbol = sym;
@@ -557,16 +581,20 @@ void sz_decode(sz_model *m, uint *symbol, uint4 *runlength)
     {   uint sy_f, lt_f;
         decode_update_shift(&(MOD.ac), MOD.whatmod[2], MOD.whatmod[0]+MOD.whatmod[1], 6);
         MOD.whatmod[2] += 6;
+        STATCOUNT(MOD.stats.what[2]++);
         /* first adjust the size of the MTF */
         if (MOD.mtfsizeact>MTFSIZE) /* active MTF too big */
         {   uint n, i;
             i = MOD.mtffirst;
             for (n=0; n<MTFSIZE; n++) /* skip active part of MTF */
-                i = MOD.mtfhist[i].next;
+            {   i = MOD.mtfhist[i].next;
+                STATCOUNT(MOD.stats.mtfsteps++);
+            }
             while (n<MOD.mtfsizeact)
-            {   bitreactivate(&(MOD.full),MOD.mtfhist[i].sym);
+            {   fullreactivate(&(MOD.full),MOD.mtfhist[i].sym);
                 MOD.lastseen[MOD.mtfhist[i].sym] = FULLFLAG;
                 i = MOD.mtfhist[i].next;
+                STATCOUNT(MOD.stats.mtfsteps++);
                 n++;
             }
             MOD.mtfsizeact = MTFSIZE;
@@ -581,19 +609,23 @@ void sz_decode(sz_model *m, uint *symbol, uint4 *runlength)
             else
             {   pred = MOD.mtfhist + MOD.mtffirst;
                 for(n=MOD.mtfsizeact-1; n; n--)
-                    pred = MOD.mtfhist + pred->next;
+                {   pred = MOD.mtfhist + pred->next;
+                    STATCOUNT(MOD.stats.mtfsteps++);
+                }
             }
             while (MOD.mtfsizeact<MTFSIZE && activatenext(&(MOD), &(pred->next)))
-                pred = MOD.mtfhist + pred->next;
+            {   pred = MOD.mtfhist + pred->next;
+                STATCOUNT(MOD.stats.mtfsteps++);
+            }
         }
-        sym = bitgetsym( &(MOD.full), decode_culfreq( &(MOD.ac), bittotf(&(MOD.full))));
-        bitgetfreq( &(MOD.full), sym, &sy_f, &lt_f );
-        decode_update(&(MOD.ac), sy_f, lt_f, bittotf(&(MOD.full)));
-        bitupdate_ex(&(MOD.full), sym);
+        sym = fullgetsym( &(MOD.full), decode_culfreq( &(MOD.ac), fulltotf(&(MOD.full))));
+        fullgetfreq( &(MOD.full), sym, &sy_f, &lt_f );
+        decode_update(&(MOD.ac), sy_f, lt_f, fulltotf(&(MOD.full)));
+        fullupdate_ex(&(MOD.full), sym);
       { cacheptr free = MOD.newest->next;
         MOD.newest = free;
         free->what = 2;
-        free->weight = readrun(MOD.rlemod, runlength);
+        free->weight = readrun(m, MOD.rlemod, runlength);
         free->sy_f = free->weight;
       }
         *symbol = sym;
@@ -602,10 +634,64 @@ void sz_decode(sz_model *m, uint *symbol, uint4 *runlength)
 };
 
 
+/* encode a whole sorted block as runs, including fixafterfirst */
+/* buffer must have room for one more byte (used as sentinel)   */
+void sz_encodeblock(sz_model *m, unsigned char *buffer, uint4 length)
+{   unsigned char *end;
+    end = buffer+length;
+    *end = ~*(end-1); /* to make sure we end a run at end */
+   {unsigned char ch, *begin;
+    begin = buffer;
+    ch = *(buffer++);
+    while (*buffer==ch)
+       buffer++;
+    sz_encode(m, ch, (uint4)(buffer-begin));
+   }
+    fixafterfirst(m);
+    while (buffer<end)
+    {   unsigned char ch, *begin;
+        begin = buffer;
+        ch = *(buffer++);
+        while (*buffer==ch)
+            buffer++;
+        sz_encode(m, ch, (uint4)(buffer-begin));
+    }
+}
+
+
+/* decode a whole block of length bytes into buffer             */
+/* counts (256 entries, zeroed) gets the number of each byte    */
+/* returns 0 on success, 1 if the input is corrupt              */
+int sz_decodeblock(sz_model *m, unsigned char *buffer, uint4 length,
+    uint4 *counts)
+{   uint4 bytesleft = length;
+    int first = 1;
+    while (bytesleft)
+    {   uint4 runlength;
+        uint ch;
+        sz_decode(m, &ch, &runlength);
+        if (runlength>bytesleft)
+            return 1;
+        bytesleft -= runlength;
+        counts[ch] += runlength;
+        while (runlength)
+        {   *(buffer++) = ch;
+            runlength--;
+        }
+        if (first)
+        {   fixafterfirst(m);
+            first = 0;
+        }
+    }
+    return 0;
+}
+
+
 /* initialisation if the model */
 /* headersize -1 means decompression */
 /* first is the first byte written by the arithcoder */
-void initmodel(sz_model *m, int headersize, unsigned char *first)
+void initmodel(sz_model *m, int headersize, unsigned char *first,
+    sz_profile *profile)
 {   int i;
 
     /* init the arithcoder */
@@ -614,8 +700,22 @@ void initmodel(sz_model *m, int headersize, unsigned char *first)
     else
         *first = start_decoding(&(MOD.ac));
 
+#ifdef SZSTATS
+    memset(&(MOD.stats), 0, sizeof(sz_stats));
+#endif
+
+    /* the tables of the last block are reused if the direction is the same */
+    if (MOD.tables && MOD.tables != 2-MOD.compress)
+        sz_freemodel(m);
+
     /* init the full model */
-    initbitmodel(&(MOD.full), ALPHABETSIZE, 40*ALPHABETSIZE, 10*ALPHABETSIZE, NULL);
+    if (MOD.tables)
+    {   STATCOUNT(MOD.full.rescales = 0);
+        resetfullmodel(&(MOD.full), profile ? profile->full : NULL);
+    }
+    else
+        initfullmodel(&(MOD.full), ALPHABETSIZE, 40*ALPHABETSIZE, 10*ALPHABETSIZE,
+            profile ? profile->full : NULL);
     for(i=0; i<ALPHABETSIZE; i++)
         MOD.lastseen[i] = FULLFLAG;
 
@@ -624,12 +724,12 @@ void initmodel(sz_model *m, int headersize, unsigned char *first)
     for(i=0; i<CACHESIZE-1; i++)
     {   tmp->next = tmp+1;
         tmp->prev = tmp-1;
-        tmp->symbol = CACHESIZE - 2 - i;
+        tmp->symbol = profile ? profile->sym[CACHESIZE-2-i] : CACHESIZE - 2 - i;
         MOD.lastseen[tmp->symbol] = tmp;
-        bitdeactivate(&(MOD.full),tmp->symbol);
+        fulldeactivate(&(MOD.full),tmp->symbol);
 	tmp->sy_f = 1;
         tmp->weight = 1;
-        tmp->what = 0;
+        tmp->what = profile ? profile->what[i] : 0;
         tmp++;
     }
     MOD.cache[0].prev = MOD.cache + (CACHESIZE-1);
@@ -640,37 +740,53 @@ void initmodel(sz_model *m, int headersize, unsigned char *first)
     MOD.newest = MOD.cache + (CACHESIZE-2);
     MOD.lastnew = MOD.cache + (CACHESIZE-7);
     MOD.cachetotf = CACHESIZE; // for starup only, decremented by 1 later
-    /* initialize the whatmodel */
-    MOD.whatmod[0] = 41; // 1 + 22*1 + 3*6
-    MOD.whatmod[1] = 8;  // 1 + 1*1 + 1*6
-    MOD.whatmod[2] = 15; // 1 + 2*1 + 2*6
-    /* make 2 old and 2 new full hits for what */
-    for(i=0; i<2; i++)
-    {   MOD.cache[i].what = 2;
-        MOD.lastnew[i].what = 2;
-    }
-    /* make 1 old and 1 new hit for MTF */
-    MOD.cache[2].what = 1;
-    MOD.lastnew[2].what = 1;
+    if (profile == NULL)
+    {   /* make 2 old and 2 new full hits for what */
+        for(i=0; i<2; i++)
+        {   MOD.cache[i].what = 2;
+            MOD.lastnew[i].what = 2;
+        }
+        /* make 1 old and 1 new hit for MTF */
+        MOD.cache[2].what = 1;
+        MOD.lastnew[2].what = 1;
+    }
+    /* initialize the whatmodel: 1 plus 1 for each old and 6 for each */
+    /* new entry (from lastnew on) of the cache; 41, 8, 15 by default */
+    MOD.whatmod[0] = MOD.whatmod[1] = MOD.whatmod[2] = 1;
+    for(i=0; i<CACHESIZE-1; i++)
+        MOD.whatmod[MOD.cache[i].what] += MOD.cache+i < MOD.lastnew ? 1 : 6;
 
     
     /* init the mtf models with symbols CACHESIZE .. (CACHESIZE+MTFSIZE<<1)*/
     MOD.mtfhist[0].next = MTFHISTSIZE-1;
-    MOD.mtfhist[0].sym = CACHESIZE;
     for(i=1; i<MTFSIZE<<1; i++)
-    {   MOD.mtfhist[i].next = i-1;
-        MOD.mtfhist[i].sym = CACHESIZE+i;
-    }
+        MOD.mtfhist[i].next = i-1;
+    for(i=0; i<MTFSIZE<<1; i++)
+        MOD.mtfhist[i].sym = profile ? profile->sym[CACHESIZE-2+(MTFSIZE<<1)-i] :
+            CACHESIZE+i;
     for(; i<MTFHISTSIZE; i++)
         MOD.mtfhist[i].next = 0xffff;
     MOD.mtfsize = MTFSIZE<<1;
     MOD.mtfsizeact = 0;
     MOD.mtffirst = (MTFSIZE<<1) - 1;
-    initqsmodel(&(MOD.mtfmod),MTFSIZE,MTFSHIFT,400,NULL,MOD.compress);
+    if (MOD.tables)
+    {   STATCOUNT(MOD.mtfmod.rescales = 0);
+        resetqsmodel(&(MOD.mtfmod), profile ? profile->mtf : NULL);
+    }
+    else
+        initqsmodel(&(MOD.mtfmod),MTFSIZE,MTFSHIFT,400,
+            profile ? profile->mtf : NULL,MOD.compress);
 
     /* init the runlengthmodels */
     for(i=0; i<5; i++)
-        initqsmodel(MOD.rlemod+i,7,RLSHIFT,150,NULL,MOD.compress);
+        if (MOD.tables)
+        {   STATCOUNT(MOD.rlemod[i].rescales = 0);
+            resetqsmodel(MOD.rlemod+i, profile ? profile->rle[i] : NULL);
+        }
+        else
+            initqsmodel(MOD.rlemod+i,7,RLSHIFT,150,
+                profile ? profile->rle[i] : NULL,MOD.compress);
+    MOD.tables = 2-MOD.compress;
 }
 
 
@@ -681,23 +797,215 @@ void fixafterfirst(sz_model *m)
 
 
 /* deletion of the model */
-void deletemodel(sz_model *m)
-{   int i;
-    if (MOD.compress)
+uint4 deletemodel(sz_model *m)
+{   if (MOD.compress)
         MOD.ac.bytecount = done_encoding(&(MOD.ac));
     else
-        done_decoding(&(MOD.ac));
+        MOD.ac.bytecount = done_decoding(&(MOD.ac));
 
 //fprintf(stderr,"%d %d %d ",MOD.ac.bytecount,MAXCACHESIZE,MTFSIZE);
 //for(i=0; i<MTFSIZE; i++) fprintf(stderr,"%d ",modelused[i]);
 
+    return MOD.ac.bytecount;
+}
+
+
+/* free the tables of the model */
+void sz_freemodel(sz_model *m)
+{   int i;
+    if (!MOD.tables)
+        return;
     /* delete the fullmodel */
-    deletebitmodel(&(MOD.full));
+    deletefullmodel(&(MOD.full));
 
     /* delete the mtfmodel */
     deleteqsmodel(&(MOD.mtfmod));
 
-    /* init the runlengthmodels */
+    /* delete the runlengthmodels */
     for(i=0; i<5; i++)
         deleteqsmodel(MOD.rlemod+i);
+    MOD.tables = 0;
+}
+
+
+#ifdef SZSTATS
+/* print the counters collected for the current block */
+void sz_printstats(sz_model *m, FILE *f)
+{   uint4 syms, rescales;
+    int i;
+    syms = MOD.stats.what[0] + MOD.stats.what[1] + MOD.stats.what[2];
+    if (syms == 0) syms = 1;
+    fprintf(f, "\n  submodel   cache %lu (%.1f%%)  mtf %lu (%.1f%%)  full %lu (%.1f%%)",
+        (unsigned long)MOD.stats.what[0], 100.0*MOD.stats.what[0]/syms,
+        (unsigned long)MOD.stats.what[1], 100.0*MOD.stats.what[1]/syms,
+        (unsigned long)MOD.stats.what[2], 100.0*MOD.stats.what[2]/syms);
+    fprintf(f, "\n  mtf rank  ");
+    for (i=0; i<MTFSIZE; i++)
+        fprintf(f, " %lu", (unsigned long)MOD.stats.mtfrank[i]);
+    fprintf(f, "\n  runlength  1:%lu 2:%lu 3:%lu 4:%lu 5-8:%lu 9-16:%lu 17+:%lu",
+        (unsigned long)MOD.stats.runclass[0], (unsigned long)MOD.stats.runclass[1],
+        (unsigned long)MOD.stats.runclass[2], (unsigned long)MOD.stats.runclass[3],
+        (unsigned long)MOD.stats.runclass[4], (unsigned long)MOD.stats.runclass[5],
+        (unsigned long)MOD.stats.runclass[6]);
+    fprintf(f, "\n  steps      cache %lu (%.2f/symbol)  mtf %lu (%.2f/symbol)",
+        (unsigned long)MOD.stats.cachesteps, (double)MOD.stats.cachesteps/syms,
+        (unsigned long)MOD.stats.mtfsteps, (double)MOD.stats.mtfsteps/syms);
+    rescales = MOD.mtfmod.rescales;
+    for (i=0; i<5; i++)
+        rescales += MOD.rlemod[i].rescales;
+    fprintf(f, "\n  rescales   qsmodel %lu  full %lu\n  coder      %lu renormalisation bytes\n",
+        (unsigned long)rescales, (unsigned long)MOD.full.rescales,
+        (unsigned long)renorm_count(&(MOD.ac)));
+}
+#endif
+
+
+/***************************** profiles *****************************/
+
+#define FULLPRIOR (8*ALPHABETSIZE) /* total frequency of a profile's full model */
+
+static void learnqs(qsmodel *q, double *l)
+{   int i;
+    for (i=0; i<q->n; i++)
+        l[i] += (double)(q->cf[i+1]-q->cf[i]) / q->cf[q->n];
+}
+
+void sz_learnblock(sz_model *m, unsigned char *buffer, uint4 length,
+    sz_learning *l)
+{   double sum=0;
+    uint4 i;
+    for (i=0; i<ALPHABETSIZE; i++)
+        sum += MOD.full.f[i] & 0x7fff;
+    for (i=0; i<ALPHABETSIZE; i++)
+        l->full[i] += (MOD.full.f[i] & 0x7fff) / sum;
+    learnqs(&(MOD.mtfmod), l->mtf);
+    for (i=0; i<5; i++)
+        learnqs(MOD.rlemod+i, l->rle[i]);
+    for (i=0; i<CACHESIZE; i++)
+        if (MOD.cache+i != MOD.newest->next)  /* the free entry */
+            l->what[MOD.cache[i].what] += 1.0/(CACHESIZE-1);
+    for (i=0; i<length; i++)
+        l->bytes[buffer[i]] += 1.0/length;
+}
+
+
+/* n values in the proportion of a, each at least 1, summing to total */
+static void scaleprofile(double *a, int *v, int n, int total)
+{   int i, big=0, sum=0;
+    double asum=0;
+    for (i=0; i<n; i++)
+        asum += a[i];
+    for (i=0; i<n; i++)
+    {   v[i] = 1 + (asum > 0 ? (int)(a[i]/asum*(total-n)) : 0);
+        sum += v[i];
+        if (v[i] > v[big])
+            big = i;
+    }
+    v[big] += total - sum;
+}
+
+/* the what of the cache entries from..to-1 in the proportion of w */
+static void whatprofile(double *w, unsigned char *what, int from, int to)
+{   int n[3], i;
+    double sum = w[0]+w[1]+w[2];
+    if (sum <= 0)
+        sum = w[0] = 1;
+    n[2] = (int)(w[2]/sum*(to-from) + 0.5);
+    n[1] = (int)(w[1]/sum*(to-from) + 0.5);
+    if (n[1]+n[2] > to-from)
+        n[1] = to-from - n[2];
+    for (i=from; i<to; i++)
+        what[i] = i < from+n[2] ? 2 : i < from+n[2]+n[1] ? 1 : 0;
+}
+
+void sz_makeprofile(sz_learning *l, sz_profile *p)
+{   unsigned char data[SZ_PROFILESIZE], taken[ALPHABETSIZE];
+    int i, j, best;
+    scaleprofile(l->full, p->full, ALPHABETSIZE, FULLPRIOR);
+    scaleprofile(l->mtf, p->mtf, MTFSIZE, 1<<MTFSHIFT);
+    for (i=0; i<5; i++)
+        scaleprofile(l->rle[i], p->rle[i], 7, 1<<RLSHIFT);
+    whatprofile(l->what, p->what, 0, CACHESIZE-7);
+    whatprofile(l->what, p->what, CACHESIZE-7, CACHESIZE-1);
+    /* the most frequent bytes in the cache, the next ones in the MTF list */
+    memset(taken, 0, ALPHABETSIZE);
+    for (i=0; i<CACHESIZE-1+(MTFSIZE<<1); i++)
+    {   best = -1;
+        for (j=0; j<ALPHABETSIZE; j++)
+            if (!taken[j] && (best < 0 || l->bytes[j] > l->bytes[best]))
+                best = j;
+        taken[best] = 1;
+        p->sym[i] = (unsigned char)best;
+    }
+    sz_saveprofile(p, data);  /* sets the id */
+}
+
+
+/* the id of a profile is a hash (FNV-1a) of its bytes */
+static uint4 profileid(unsigned char *data)
+{   uint4 h = 2166136261u;
+    int i;
+    for (i=0; i<SZ_PROFILESIZE; i++)
+        h = (h ^ data[i]) * 16777619u;
+    return h;
+}
+
+void sz_saveprofile(sz_profile *p, unsigned char *data)
+{   unsigned char *d = data;
+    int i, j;
+    memcpy(d, "SZP\1", 4);
+    d += 4;
+    for (i=0; i<ALPHABETSIZE; i++, d+=2)
+        d[0] = p->full[i]>>8, d[1] = p->full[i]&0xff;
+    for (i=0; i<MTFSIZE; i++, d+=2)
+        d[0] = p->mtf[i]>>8, d[1] = p->mtf[i]&0xff;
+    for (j=0; j<5; j++)
+        for (i=0; i<7; i++, d+=2)
+            d[0] = p->rle[j][i]>>8, d[1] = p->rle[j][i]&0xff;
+    memcpy(d, p->what, CACHESIZE-1);
+    memcpy(d+CACHESIZE-1, p->sym, CACHESIZE-1+(MTFSIZE<<1));
+    p->id = profileid(data);
+}
+
+int sz_loadprofile(sz_profile *p, unsigned char *data, uint4 length)
+{   unsigned char *d = data, seen[ALPHABETSIZE];
+    int i, j, sum;
+    if (length != SZ_PROFILESIZE || memcmp(d, "SZP\1", 4) != 0)
+        return 1;
+    d += 4;
+    for (i=0; i<ALPHABETSIZE; i++, d+=2)
+    {   p->full[i] = d[0]<<8 | d[1];
+        if (p->full[i] < 1 || p->full[i] > 0x1000)
+            return 1;
+    }
+    for (i=sum=0; i<MTFSIZE; i++, d+=2)
+    {   p->mtf[i] = d[0]<<8 | d[1];
+        if (p->mtf[i] < 1)
+            return 1;
+        sum += p->mtf[i];
+    }
+    if (sum != 1<<MTFSHIFT)
+        return 1;
+    for (j=0; j<5; j++)
+    {   for (i=sum=0; i<7; i++, d+=2)
+        {   p->rle[j][i] = d[0]<<8 | d[1];
+            if (p->rle[j][i] < 1)
+                return 1;
+            sum += p->rle[j][i];
+        }
+        if (sum != 1<<RLSHIFT)
+            return 1;
+    }
+    for (i=0; i<CACHESIZE-1; i++)
+        if ((p->what[i] = *d++) > 2)
+            return 1;
+    memset(seen, 0, ALPHABETSIZE);
+    for (i=0; i<CACHESIZE-1+(MTFSIZE<<1); i++)
+    {   if (seen[*d])
+            return 1;
+        seen[*d] = 1;
+        p->sym[i] = *d++;
+    }
+    p->id = profileid(data);
+    return 0;
 }
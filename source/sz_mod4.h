@@ -17,16 +17,47 @@
 #ifndef SZ_MODEL4_H
 #define SZ_MODEL4_H
 
+#include <stdio.h>
 #include "port.h"
 #include "qsmodel.h"
-#include "bitmodel.h"
 #include "rangecod.h"
 
+/* the fallback model (full) is a bit indexed tree (bitmodel) by default; */
+/* compile with -DVECMODEL for the flat SIMD table (vecmodel) instead.    */
+/* both give exactly the same probabilities and thus the same format.     */
+#ifdef VECMODEL
+#include "vecmodel.h"
+typedef vecmodel fullmodel;
+#define initfullmodel initvecmodel
+#define resetfullmodel resetvecmodel
+#define deletefullmodel deletevecmodel
+#define fullgetfreq vecgetfreq
+#define fullgetsym vecgetsym
+#define fulltotf vectotf
+#define fullupdate_ex vecupdate_ex
+#define fulldeactivate vecdeactivate
+#define fullreactivate vecreactivate
+#else
+#include "bitmodel.h"
+typedef bitmodel fullmodel;
+#define initfullmodel initbitmodel
+#define resetfullmodel resetbitmodel
+#define deletefullmodel deletebitmodel
+#define fullgetfreq bitgetfreq
+#define fullgetsym bitgetsym
+#define fulltotf bittotf
+#define fullupdate_ex bitupdate_ex
+#define fulldeactivate bitdeactivate
+#define fullreactivate bitreactivate
+#endif
+
 #define ALPHABETSIZE 256
 #define CACHESIZE 32
 #define MTFSIZE 20
 #define MTFHISTSIZE 4096  /* must pe power of 2 */
+#ifndef SZ_THREADS
 #define MODELGLOBAL
+#endif
 
 typedef struct {
     uint sym, next;
@@ -39,6 +70,17 @@ typedef struct cacheS {
     cacheptr next, prev;
 } cacheentry;
 
+#ifdef SZSTATS
+/* counters for tuning, compiled in with -DSZSTATS */
+typedef struct {
+    uint4 what[3];    /* symbols coded in cache, MTF and full model */
+    uint4 mtfrank[MTFSIZE]; /* MTF hits by rank */
+    uint4 runclass[7];/* runlength symbols, see sz_mod4.c */
+    uint4 cachesteps; /* list entries walked in the cache */
+    uint4 mtfsteps;   /* list entries walked in the MTF */
+} sz_stats;
+#endif
+
 typedef struct {
     uint whatmod[3];  /* probabilities for the submodels */
     cacheptr newest,  /* points to newest element in cache */
@@ -50,37 +92,105 @@ typedef struct {
     cacheptr lastseen[ALPHABETSIZE]; /* tell if and where symbol is in cache */
     cacheentry cache[CACHESIZE]; /* cache */
     mtfentry mtfhist[MTFHISTSIZE];
-    bitmodel full;    /* fallback model */
+    fullmodel full;   /* fallback model */
     qsmodel mtfmod;   /* probabilities for mtf ranks */
     qsmodel rlemod[5];
     rangecoder ac;
     uint compress;    /* 1 on compression, 0 on decompression */
+    uint tables;      /* tables of full, mtfmod and rlemod are allocated: */
+                      /* 0 no, 1 for compression, 2 for decompression     */
+#ifdef SZSTATS
+    sz_stats stats;
+#endif
 } sz_model;
 
+/* initial state of the model learned from sample data (szip --learn), */
+/* for blocks too small to train the model themselves                   */
+typedef struct {
+    uint4 id;         /* identifies the profile in the block header */
+    int full[ALPHABETSIZE];  /* frequencies of the full model */
+    int mtf[MTFSIZE]; /* of the MTF ranks */
+    int rle[5][7];    /* of the runlength models */
+    unsigned char what[CACHESIZE-1]; /* submodel of the cache entries, oldest first */
+    unsigned char sym[CACHESIZE-1+(MTFSIZE<<1)]; /* symbols in the cache, then */
+                      /* in the MTF list, each newest first; all different */
+} sz_profile;
+
+/* statistics of blocks collected for a profile */
+typedef struct {
+    double full[ALPHABETSIZE], mtf[MTFSIZE], rle[5][7], what[3];
+    double bytes[ALPHABETSIZE];
+} sz_learning;
+
+/* bytes of a profile as stored in a file */
+#define SZ_PROFILESIZE (4 + 2*(ALPHABETSIZE+MTFSIZE+5*7) + CACHESIZE-1 + \
+                        CACHESIZE-1+(MTFSIZE<<1))
+
 #ifdef MODELGLOBAL
-#define initmodel(m,a,b) M_initmodel(a,b)
+#define initmodel(m,a,b,c) M_initmodel(a,b,c)
 #define fixafterfirst(m) M_fixafterfirst()
 #define deletemodel(m) M_deletemodel()
+#define sz_freemodel(m) M_sz_freemodel()
 #define sz_finishrun(m) M_sz_finishrun()
 #define sz_encode(m,a,b) M_sz_encode(a,b)
 #define sz_decode(m,a,b) M_sz_decode(a,b)
+#define sz_encodeblock(m,a,b) M_sz_encodeblock(a,b)
+#define sz_decodeblock(m,a,b,c) M_sz_decodeblock(a,b,c)
+#define sz_printstats(m,a) M_sz_printstats(a)
+#define sz_learnblock(m,a,b,c) M_sz_learnblock(a,b,c)
 #endif
 
 
-/* initialisation if the model */
+/* initialisation if the model; m must be zero before the first time */
 /* headersize -1 means decompression */
 /* first is the first byte written by the arithcoder */
-void initmodel(sz_model *m, int headersize, unsigned char *first);
+/* profile gives the initial state; NULL for the built in one */
+void initmodel(sz_model *m, int headersize, unsigned char *first,
+    sz_profile *profile);
 
 /* call fixafterfirst after encoding/decoding the first run */
 void fixafterfirst(sz_model *m);
 
 /* deletion of the model */
-void deletemodel(sz_model *m);
+/* returns the number of bytes written resp. read by the coder */
+/* the tables of the model are kept for the next initmodel     */
+uint4 deletemodel(sz_model *m);
+
+/* free the tables of the model; it can be initialized again */
+void sz_freemodel(sz_model *m);
 
 /* encode/decode a run of equal symbols */
 void sz_encode(sz_model *m, uint symbol, uint4 runlength);
 void sz_decode(sz_model *m, uint *symbol, uint4 *runlength);
 
+/* encode a whole sorted block as runs, including fixafterfirst */
+/* buffer must have room for one more byte (used as sentinel)   */
+void sz_encodeblock(sz_model *m, unsigned char *buffer, uint4 length);
+
+/* decode a whole block of length bytes into buffer             */
+/* counts (256 entries, zeroed) gets the number of each byte    */
+/* returns 0 on success, 1 if the input is corrupt              */
+int sz_decodeblock(sz_model *m, unsigned char *buffer, uint4 length,
+    uint4 *counts);
+
+#ifdef SZSTATS
+/* print the counters collected for the current block */
+void sz_printstats(sz_model *m, FILE *f);
+#endif
+
+/* add the state of the model after coding the length bytes of buffer */
+/* to l (call before deletemodel); every block counts the same        */
+void sz_learnblock(sz_model *m, unsigned char *buffer, uint4 length,
+    sz_learning *l);
+
+/* make a profile of what l collected */
+void sz_makeprofile(sz_learning *l, sz_profile *p);
+
+/* write p to data (SZ_PROFILESIZE bytes) */
+void sz_saveprofile(sz_profile *p, unsigned char *data);
+
+/* read p from data; returns 1 if data is no valid profile */
+int sz_loadprofile(sz_profile *p, unsigned char *data, uint4 length);
+
 
 #endif
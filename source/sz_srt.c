@@ -22,6 +22,9 @@
 #include "port.h"
 #include "sz_err.h"
 #include "sz_srt.h"
+#ifdef unix
+#include <sys/mman.h>
+#endif
 
 #if defined SZ_UNSRT_O4
 #include "sz_hash2.h"		// only used in sz_unsrt_o4
@@ -53,37 +56,187 @@ typedef struct {
 	ptrblock *block;
 	ptrblock *spare[18];
 	uint4 nrblocks;
+	sz_workspace *w;
 } ptrstruct;
 
 
-static ptrstruct globalptr;
-static int globalinit = 0;
+/******************************** workspace ********************************/
+
+static void *workalloc(sz_workspace *w, size_t size)
+{	return w->alloc ? w->alloc(w->opaque, size) : malloc(size);
+}
+
+static void workrelease(sz_workspace *w, void *ptr)
+{	if (ptr == NULL)
+		return;
+	if (w->free)
+		w->free(w->opaque, ptr);
+	else
+		free(ptr);
+}
+
+#define HUGEPAGE 0x200000
+
+// size bytes (a multiple of HUGEPAGE) aligned to and backed by huge pages
+// if the system has them, every page touched; NULL if mmap fails
+static void *hugealloc(size_t size, int huge)
+{
+#if defined unix && defined MAP_ANONYMOUS
+	unsigned char *p = (unsigned char*) MAP_FAILED;
+	size_t i, head;
+#ifdef MAP_HUGETLB
+	if (huge == SZ_HUGE_TLB)
+		p = (unsigned char*) mmap(NULL, size, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE, -1, 0);
+	if (p != MAP_FAILED)
+		return p;
+#endif
+	// transparent huge pages need an aligned range: map more and cut
+	p = (unsigned char*) mmap(NULL, size+HUGEPAGE, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	head = (HUGEPAGE - ((size_t)p & (HUGEPAGE-1))) & (HUGEPAGE-1);
+	if (head)
+		munmap(p, head);
+	munmap(p+head+size, HUGEPAGE-head);
+	p += head;
+#ifdef MADV_HUGEPAGE
+	madvise(p, size, MADV_HUGEPAGE);
+#endif
+	for (i=0; i<size; i+=0x1000)
+		((volatile unsigned char*)p)[i] = 0;
+	return p;
+#else
+	(void)size; (void)huge;
+	return NULL;
+#endif
+}
+
+static void releasebuf(sz_workspace *w, int which)
+{
+#if defined unix && defined MAP_ANONYMOUS
+	if (w->mapped[which])
+		munmap(w->buf[which], w->size[which]);
+	else
+#endif
+		workrelease(w, w->buf[which]);
+	w->buf[which] = NULL;
+	w->size[which] = 0;
+	w->mapped[which] = 0;
+}
+
+// make buffer which at least size bytes; 1 if out of memory
+static int workgrow(sz_workspace *w, int which, size_t size)
+{	void *ptr;
+	if (size <= w->size[which])
+		return 0;
+	releasebuf(w, which);
+	if (w->huge && w->alloc == NULL && size >= SZ_HUGEMIN)
+	{	size_t mapsize = (size+HUGEPAGE-1) & ~(size_t)(HUGEPAGE-1);
+		if ((ptr = hugealloc(mapsize, w->huge)) != NULL)
+		{	w->buf[which] = ptr;	// zero like all fresh pages
+			w->size[which] = mapsize;
+			w->mapped[which] = 1;
+			return 0;
+		}
+	}
+	if (which == SZW_COUNTS && w->alloc == NULL)
+		ptr = calloc(size, 1);	// fresh pages need no clearing
+	else if ((ptr = workalloc(w, size)) != NULL && which == SZW_COUNTS)
+		memset(ptr, 0, size);
+	if (ptr == NULL)
+		return 1;
+	w->buf[which] = ptr;
+	w->size[which] = size;
+	return 0;
+}
+
+void sz_workinit(sz_workspace *w, sz_allocfunc allocfn, sz_freefunc freefn, void *opaque)
+{	memset(w, 0, sizeof(sz_workspace));
+	w->alloc = allocfn;
+	w->free = freefn;
+	w->opaque = opaque;
+}
+
+void *sz_workget(sz_workspace *w, int which, size_t size)
+{	if (workgrow(w, which, size))
+		sz_error(SZ_NOMEM_SORT);
+	return w->buf[which];
+}
 
-static void allocptrs(uint4 length, ptrstruct *p)
+// the sizes sz_workreserve gives the buffers (0: not needed)
+static void worksizes(size_t *size, uint4 maxblock, unsigned int order, int compress,
+	uint4 extraspare)
+{	size_t n = maxblock, nrblocks = (n+BLOCKSIZE-1)/BLOCKSIZE;
+	size_t spare = (n>>BITSSAMEBLOCK) + 1;
+	memset(size, 0, SZW_BUFFERS*sizeof(size_t));
+	if (!compress)
+	{	size[SZW_TABLE] = (n+1)*sizeof(uint4);
+		if (order != 0)
+			size[SZW_FLAGS1] = size[SZW_FLAGS2] = (n+8)>>3;
+		return;
+	}
+	if (spare > 256)
+		spare = 256;
+	if (n >= 0x1000)
+		size[SZW_PAIRS] = 2*0x10000*sizeof(uint4);
+	if (order == 0)
+	{	size[SZW_CONTEXT] = n*sizeof(uint4);
+		return;
+	}
+	size[SZW_COUNTS] = 0x10000*sizeof(uint4);
+#if defined SZ_SRT_O4
+	if (order == 4)
+	{	size[SZW_CONTEXT] = n*sizeof(uint2);
+		size[SZW_SYMBOLS] = n;
+		return;
+	}
+#endif
+	size[SZW_INDEX] = size[SZW_OLDINDEX] = nrblocks*sizeof(ptrblock*);
+	size[SZW_BLOCKS] = nrblocks*sizeof(ptrblock);
+	size[SZW_SPARE] = (spare+extraspare)*sizeof(ptrblock);
+}
+
+int sz_workreserve(sz_workspace *w, uint4 maxblock, unsigned int order, int compress)
+{	size_t size[SZW_BUFFERS];
+	int i;
+	worksizes(size, maxblock, order, compress, w->extraspare);
+	for (i=0; i<SZW_BUFFERS; i++)
+		if (size[i] && workgrow(w, i, size[i]))
+			return 1;
+	return 0;
+}
+
+size_t sz_workneed(uint4 maxblock, unsigned int order, int compress)
+{	size_t size[SZW_BUFFERS], need = 0;
+	int i;
+	worksizes(size, maxblock, order, compress, 0);
+	for (i=0; i<SZW_BUFFERS; i++)
+		need += size[i];
+	return need;
+}
+
+int sz_workgrow(sz_workspace *w, int which, size_t size)
+{	return workgrow(w, which, size);
+}
+
+void sz_workfree(sz_workspace *w)
+{	int i;
+	for (i=0; i<SZW_BUFFERS; i++)
+		releasebuf(w, i);
+}
+
+
+/********************************** sorter *********************************/
+
+static void allocptrs(sz_workspace *w, uint4 length, ptrstruct *p)
 {	uint4 i;
+	p->w = w;
 	p->nrblocks = (length+BLOCKSIZE-1)/BLOCKSIZE;
-	if (globalinit && (p->nrblocks>globalptr.nrblocks)) {
-		free(globalptr.index);
-		free(globalptr.oldindex);
-		free(globalptr.block);
-	    globalinit = 0;
-	}
-	if (!globalinit) {
-		globalptr.nrblocks = p->nrblocks;
-		globalptr.index = (ptrblock**) malloc(sizeof(ptrblock*)*globalptr.nrblocks);
-		if (globalptr.index == NULL)
-			sz_error(SZ_NOMEM_SORT);
-		globalptr.oldindex = (ptrblock**) malloc(sizeof(ptrblock*)*globalptr.nrblocks);
-		if (globalptr.oldindex == NULL)
-			sz_error(SZ_NOMEM_SORT);
-		globalptr.block = (ptrblock*) malloc(sizeof(ptrblock)*globalptr.nrblocks);
-		if (globalptr.block == NULL)
-			sz_error(SZ_NOMEM_SORT);
-	    globalinit = 1;
-	}
-	p->index = globalptr.index;
-	p->oldindex = globalptr.oldindex;
-	p->block = globalptr.block;
+	p->index = (ptrblock**) sz_workget(w, SZW_INDEX, sizeof(ptrblock*)*p->nrblocks);
+	p->oldindex = (ptrblock**) sz_workget(w, SZW_OLDINDEX, sizeof(ptrblock*)*p->nrblocks);
+	p->block = (ptrblock*) sz_workget(w, SZW_BLOCKS, sizeof(ptrblock)*p->nrblocks);
 	p->freelist = NULL;
 	for(i=0; i<18; i++)
 		p->spare[i] = NULL;
@@ -91,33 +244,41 @@ static void allocptrs(uint4 length, ptrstruct *p)
 		p->index[i] = p->block + i;
 }
 
+// put blocks at the start of the freelist
+static void linkspare(ptrstruct *p, ptrblock *spare, int blocks)
+{	int i;
+	spare[blocks-1].nextfree = p->freelist;
+	for(i=1; i<blocks; i++)
+		spare[i-1].nextfree = spare + i;
+	p->freelist = spare;
+}
+
 static void extraspare(ptrstruct *p, int blocks)
 {	int i;
 	for (i=0; p->spare[i]!= NULL; i++)
 		/* void */;
-	p->spare[i] = (ptrblock*) malloc(sizeof(ptrblock)*blocks);
+	p->spare[i] = (ptrblock*) workalloc(p->w, sizeof(ptrblock)*blocks);
 	if (p->spare[i] == NULL)
 		sz_error(SZ_NOMEM_SORT);
-	p->spare[i]->nextfree = p->freelist;
-	p->freelist = p->spare[i];
-	for(i=1; i<blocks; i++)
-		p->freelist[i-1].nextfree = p->freelist + i;
-	p->freelist[blocks-1].nextfree = NULL;
+	linkspare(p, p->spare[i], blocks);
 }
 
+// the first spare blocks are kept in the workspace for the next sort;
+// more are allocated by setptr as needed and freed again, and the
+// workspace keeps that many more the next time
 static void allocspareptrs(uint4 length, ptrstruct *p)
 {	length = (length>>BITSSAMEBLOCK) + 1;
 	if (length>256) length = 256;
-	extraspare(p,length);
+	length += p->w->extraspare;
+	linkspare(p, (ptrblock*) sz_workget(p->w, SZW_SPARE, sizeof(ptrblock)*length), length);
 }
 
 static void freeptrs(ptrstruct *p)
 {	int i;
-//	free(p->index);
-//	free(p->oldindex);
-//	free(p->block);
 	for (i=0; p->spare[i] != NULL; i++)
-		free(p->spare[i]);
+	{	workrelease(p->w, p->spare[i]);
+		p->w->extraspare += 16;
+	}
 }
 
 static Inline void setptr(ptrstruct *p, uint4 i, uint4 ptr)
@@ -134,35 +295,68 @@ static Inline void setptr(ptrstruct *p, uint4 i, uint4 ptr)
 	tmp->lsbyte[i] = ptr & 0xff;
 }
 
+// The order 2 counters of sortorder2 and sz_srt_o4 are kept zero between
+// calls. A context is made of two symbols of the block, so only the
+// counters of pairs of symbols that occur are summed and cleared; small
+// blocks do not pay for all 64k of them.
+
+// the symbols flagged in used in descending order; returns their number
+static uint usedsymbols(unsigned char *used, unsigned char *sym)
+{	uint i, n=0;
+	for (i=0x100; i--; )
+		if (used[i])
+			sym[n++] = (unsigned char)i;
+	return n;
+}
+
+// replace the counts of the contexts by their start positions
+static void addcontexts(uint4 *c, uint4 length, unsigned char *sym, uint n)
+{	uint a, b;
+	uint4 sum = length, *row;
+	for (a=0; a<n; a++)
+	{	row = c + ((uint)sym[a]<<8);
+		for (b=0; b<n; b++)
+		{	sum -= row[sym[b]];
+			row[sym[b]] = sum;
+		}
+	}
+}
+
+static void clearcontexts(uint4 *c, unsigned char *sym, uint n)
+{	uint a, b;
+	uint4 *row;
+	for (a=0; a<n; a++)
+	{	row = c + ((uint)sym[a]<<8);
+		for (b=0; b<n; b++)
+			row[sym[b]] = 0;
+	}
+}
+
 static void sortorder2(ptrstruct *p, unsigned char *in, uint4 length,
 					   uint4 *counts, unsigned int offset, uint4 *indexlast)
-{	uint4 i, *o2counts, sum;
-	unsigned int context;
+{	uint4 i, sum, *o2counts;
+	unsigned int context, nsym;
+	unsigned char used[256], sym[256];
 	memset(counts, 0, 256*sizeof(uint4));
-	o2counts = (uint4*) calloc(0x10000, sizeof(uint4));
-	if (o2counts == NULL)
-		sz_error(SZ_NOMEM_SORT);
+	o2counts = (uint4*) sz_workget(p->w, SZW_COUNTS, 0x10000*sizeof(uint4));
 	context = (unsigned)in[length-1]<<8;
 	for(i=0; i<length; i++)
 	{	context = context>>8 | (unsigned)(in[i])<<8;
 		counts[in[i]]++;
 		o2counts[context]++;
 	}
-	sum = length;
-	for (i=0x10000; i--; )
-	{	sum -= o2counts[i];
-		o2counts[i] = sum;
-	}
+	context = (unsigned)in[length-offset]<<8 | in[length-offset-1];
+	*indexlast = o2counts[context]-1;	// plus the start of context below
+	for (i=0; i<0x100; i++)
+		used[i] = counts[i] != 0;
+	nsym = usedsymbols(used, sym);
+	addcontexts(o2counts, length, sym, nsym);
+	*indexlast += o2counts[context];
 	sum = length;
 	for (i=0x100; i--; )
 	{	sum -= counts[i];
 		counts[i] = sum;
 	}
-	context = (unsigned)in[length-offset]<<8 | in[length-offset-1];
-	if (context == 0xffff)
-		*indexlast = length-1;
-	else
-		*indexlast = o2counts[context+1]-1;
 	offset--;
 	for(i=0; i<offset; i++)
 	{	in[i+length] = in[i];
@@ -175,7 +369,7 @@ static void sortorder2(ptrstruct *p, unsigned char *in, uint4 length,
 		setptr(p,o2counts[context],i);
 		o2counts[context]++;
 	}
-	free(o2counts);
+	clearcontexts(o2counts, sym, nsym);
 }
 
 static void incsortorder(ptrstruct *p, unsigned char *in, uint4 length,
@@ -272,11 +466,12 @@ static void finishsort(ptrstruct *p, unsigned char *in, uint4 length,
 // order: order of context used in sorting (must be >=3)
 // the code assumes length>=order
 // and inout is length+order bytes long (only the first length need to be filled)
-void sz_srt(unsigned char *inout, uint4 length, uint4 *indexlast, unsigned int order)
+void sz_srt(sz_workspace *w, unsigned char *inout, uint4 length, uint4 *indexlast,
+			unsigned int order)
 {	uint4 i;
 	ptrstruct p;
 	uint4 counts[256];
-	allocptrs(length, &p);
+	allocptrs(w, length, &p);
 	sortorder2(&p, inout, length, counts, order, indexlast);
 	allocspareptrs(length, &p);
 	for (i=order-2; i>1; i--)
@@ -286,11 +481,96 @@ void sz_srt(unsigned char *inout, uint4 length, uint4 *indexlast, unsigned int o
 }
 
 
+static const unsigned int autoorders[AUTOORDERS] = {3, 4, 6, 8, 12};
+static const uint8 automasks[AUTOORDERS-1] = {0xffffffULL, 0xffffffffULL,
+	0xffffffffffffULL, 0xffffffffffffffffULL};
+#define AUTOBITS 14			// log2 of the table size per order
+#define AUTOCHUNK 0x2000	// large blocks are sampled in chunks of this size
+#define AUTOCHUNKS 8
+
+// Within a context the sort keeps the input order, so the number of symbols
+// differing from the last one seen in the same context is the number of run
+// breaks in the sorted block. A context seen the first time counts as a break
+// if the next lower order breaks, as its neighbour in the sort shares that one.
+// The contexts are hashed with an 8 bit check; collisions only add noise.
+// Fewer breaks turned out to be a good enough predictor of smaller output.
+unsigned int sz_bestorder(sz_workspace *w, unsigned char *in, uint4 length, uint4 *breaks)
+{	uint2 *last;
+	uint4 i, k, chunk, nchunks, start, end, best;
+	uint8 c, c2, h;
+	last = (uint2*) sz_workget(w, SZW_AUTO, sizeof(uint2)*AUTOORDERS<<AUTOBITS);
+	memset(last, 0, sizeof(uint2)*AUTOORDERS<<AUTOBITS);
+	memset(breaks, 0, sizeof(uint4)*AUTOORDERS);
+	nchunks = length > AUTOCHUNK*AUTOCHUNKS ? AUTOCHUNKS : 1;
+	for (chunk=0; chunk<nchunks; chunk++)
+	{	if (nchunks == 1)
+		{	start = 0;
+			end = length;
+		} else
+		{	start = (uint4)((uint8)(length-AUTOCHUNK)*chunk/(AUTOCHUNKS-1));
+			end = start + AUTOCHUNK;
+		}
+		c = c2 = 0;		// the last 8 bytes and the 4 before them
+		for (i = start>12 ? start-12 : 0; i<start; i++)
+		{	c2 = c2<<8 | c>>56;
+			c = c<<8 | in[i];
+		}
+		for ( ; i<end; i++)
+		{	int brk = 1;
+			for (k=0; k<AUTOORDERS; k++)
+			{	uint2 *e, check;
+				if (k < AUTOORDERS-1)
+					h = c & automasks[k];
+				else
+					h = c*0xff51afd7ed558ccdULL ^ (c2 & 0xffffffff);
+				h *= 0x9e3779b97f4a7c15ULL;
+				e = last + (k<<AUTOBITS) + (uint4)(h>>(64-AUTOBITS));
+				check = (uint2)((h>>(56-AUTOBITS)) & 0xff) | 1;
+				if ((*e>>8) == check)
+					brk = (*e & 0xff) != in[i];
+				breaks[k] += brk;
+				*e = check<<8 | in[i];
+			}
+			c2 = c2<<8 | c>>56;
+			c = c<<8 | in[i];
+		}
+	}
+	best = 0;
+	for (k=1; k<AUTOORDERS; k++)
+		if (autoorders[k] < length && breaks[k] < breaks[best])
+			best = k;
+	return autoorders[best];
+}
+
+
 #define INDIRECT 0x800000
 
 #define setbit(flags,bit) (flags[bit>>3] |= 1<<(bit & 7))
 #define getbit(flags,bit) ((flags[bit>>3]>>(bit&7)) & 1)
 
+// output loop of the unsorters for a recordsize other than 1: NEXT sets c
+// to the next byte, plus the previous one for -i (delta 0xff). The bytes
+// come column by column as reorder made them: byte k of column col goes to
+// out[k*r+col]; the columns have q bytes, the first rest of them one more.
+// This saves unreorder and undodelta their own passes over the block.
+#define UNSRTPLACE(NEXT) \
+	{	uint4 r = recordsize&0x7f, q = length/r, rest = length%r, p = 0, col = 0, \
+			left = q + (rest > 0); \
+		unsigned char c = 0, delta = recordsize&0x80 ? 0xff : 0; \
+		for (i=0; i<outlength; i++) \
+		{	NEXT; \
+			if (out == NULL) \
+				putc(c, stdout); \
+			else \
+				out[p] = c; \
+			p += r; \
+			if (--left == 0) \
+			{	p = ++col; \
+				left = q + (col < rest); \
+			} \
+		} \
+	}
+
 static void makeorder2(unsigned char *flags, unsigned char *in, uint4 *counts,
 					   uint4 length)
 {	uint4 i, j, ct[256];
@@ -302,6 +582,8 @@ static void makeorder2(unsigned char *flags, unsigned char *in, uint4 *counts,
 	j = 0;
 	for (i=0; i<255; i++)
 	{	uint4 k;
+		if (j == counts[i+1])
+			continue;	// no context starts with i, the bits are set already
 		for(k=counts[i+1]; j<k; j++)
 			ct[in[j]]++;
 		for(k=0; k<256; k++)
@@ -357,19 +639,18 @@ static void maketable(unsigned char *inflags, uint4 *table, unsigned char *in,
 // indexlast: position of last context (as returned bt sorttrans)
 // counts: number of occurances of each byte in in (if NULL it will be calculated)
 // order: order of context used in sorting (must be >=3)
+// outlength: number of bytes to output; if less than length unsorting stops early
 // the code assumes length>=order
-void sz_unsrt(unsigned char *in, unsigned char *out, uint4 length, uint4 indexlast,
-			uint4 *counts, unsigned int order)
-{	uint4 i, j;
-    static uint4 *table;
-	static unsigned char *flags1=NULL;
-	static unsigned char *flags2=NULL;
-	unsigned char nocounts;
+void sz_unsrt(sz_workspace *w, unsigned char *in, unsigned char *out, uint4 length,
+			uint4 indexlast, uint4 *counts, unsigned int order, uint4 outlength,
+			unsigned int recordsize)
+{	uint4 i, j, *table, owncounts[256];
+	unsigned char *flags1, *flags2;
 
 	// get counts if not supplied
-	nocounts = counts==NULL;
-	if (nocounts)
-	{	counts = (uint4*) calloc(256, sizeof(uint4));
+	if (counts==NULL)
+	{	counts = owncounts;
+		memset(counts, 0, 256*sizeof(uint4));
 		for (i=0; i<length; i++)
 			counts[in[i]]++;
 	}
@@ -380,22 +661,14 @@ void sz_unsrt(unsigned char *in, unsigned char *out, uint4 length, uint4 indexla
 		counts[i] = j;
 	}
 
-	if (flags1==NULL){
-		flags1 = (unsigned char*) calloc((length+8)>>3,1);
-		if (flags1 == NULL)
-			sz_error(SZ_NOMEM_SORT);
-	} else 
-		memset(flags1,0,(length+8)>>3);
+	flags1 = (unsigned char*) sz_workget(w, SZW_FLAGS1, (length+8)>>3);
+	memset(flags1,0,(length+8)>>3);
 
 	makeorder2(flags1, in, counts, length);
 	
 	// now incease the order to desired order-1
-	if (flags2==NULL){
-		flags2 = (unsigned char*) calloc((length+8)>>3,1);
-		if (flags2 == NULL)
-			sz_error(SZ_NOMEM_SORT);
-	} else 
-		memset(flags2,0,(length+8)>>3);
+	flags2 = (unsigned char*) sz_workget(w, SZW_FLAGS2, (length+8)>>3);
+	memset(flags2,0,(length+8)>>3);
 	for (i=2; i<order-1; i++)
 	{	unsigned char *tmpflags;
 		increaseorder(flags1, flags2, in, counts, length);
@@ -403,24 +676,27 @@ void sz_unsrt(unsigned char *in, unsigned char *out, uint4 length, uint4 indexla
 		flags1 = flags2;		// flags1 now contains the updated beginflags
 		flags2 = tmpflags;		// no need to clear, the set bits will be set again
 	}
-//	free(flags2);
 
 	// construct permutation table
-	if (table==NULL) {
-		table = (uint4*)malloc((length+1)*sizeof(uint4));
-		if (table == NULL)
-			sz_error(SZ_NOMEM_SORT);
-	}
+	table = (uint4*) sz_workget(w, SZW_TABLE, (length+1)*sizeof(uint4));
 	maketable(flags1, table, in, counts, length);
 	table[length] = INDIRECT;
-//	free(flags1);
-	if (nocounts)
-		free(counts);
 
 	// do the actual unsorting
 	j = indexlast;
-	if (out == NULL)
-		for (i=0; i<length; i++)
+	if (recordsize != 1)
+	{	UNSRTPLACE(
+			uint4 tmp = table[j];
+			if (tmp & INDIRECT)
+				j = table[tmp & ~INDIRECT]++;
+			else
+			{	table[j]++;
+				j = tmp;
+			}
+			c = (c & delta) + in[j])
+	}
+	else if (out == NULL)
+		for (i=0; i<outlength; i++)
 		{	uint4 tmp = table[j];
 			if (tmp & INDIRECT)
 			{	j = table[tmp & ~INDIRECT]++;
@@ -436,7 +712,7 @@ void sz_unsrt(unsigned char *in, unsigned char *out, uint4 length, uint4 indexla
 			putc(in[j],stdout);
 		}
 	else
-		for (i=0; i<length; i++)
+		for (i=0; i<outlength; i++)
 		{	uint4 tmp = table[j];
 			if (tmp & INDIRECT)
 				j = table[tmp & ~INDIRECT]++;
@@ -447,63 +723,49 @@ void sz_unsrt(unsigned char *in, unsigned char *out, uint4 length, uint4 indexla
 			out[i] = in[j];
 		}
 
-	if (j != indexlast)
+	if (outlength == length && j != indexlast)
 		sz_error(SZ_NOTCYCLIC);
-//	free(table);
 }
 
 
 #if defined SZ_SRT_O4
 // a fast alternate sort, only for order 4. inout only length bytes is OK here.
-void sz_srt_o4(unsigned char *inout, uint4 length, uint4 *indexlast)
-{	static uint4 *counters=NULL;
-	static uint2 *context=NULL;
-	static unsigned char *symbols=NULL;
+// counters are kept zero between calls as in sortorder2.
+void sz_srt_o4(sz_workspace *w, unsigned char *inout, uint4 length, uint4 *indexlast)
+{	uint4 *counters;
+	uint2 *context;
+	unsigned char *symbols;
 	register uint4 i;
+	uint nsym;
+	unsigned char used[256], sym[256];
 
 	// count contexts
-	if (counters==NULL) {
-		counters = (uint4*)calloc(0x10000,sizeof(uint4));
-		if (counters == NULL)
-			sz_error(SZ_NOMEM_SORT);
-	} else {
-		memset(counters,0,0x10000*sizeof(uint4));
-	}
+	counters = (uint4*) sz_workget(w, SZW_COUNTS, 0x10000*sizeof(uint4));
+	memset(used, 0, 256);
 	i = (uint)(inout[length-1])<<8;
   {	register unsigned char *tmp;
 	for (tmp=inout; tmp<inout+length; tmp++)
 	{	i = i>>8 | (uint)(*tmp)<<8;
 		counters[i]++;
+		used[*tmp] = 1;
 	}
   }
+  {	register uint4 ctx = (uint4)inout[length-4]<<8 | inout[length-5];
+	*indexlast = counters[ctx]-1;	// plus the start of ctx below
 
 	// add context counts
-  {	register uint4 sum = length;
-	for (i=0x10000; i--; )
-	{	sum -= counters[i];
-		counters[i] = sum;
-	}
+	nsym = usedsymbols(used, sym);
+	addcontexts(counters, length, sym, nsym);
+	*indexlast += counters[ctx];
   }
 
 	// first sort pass
-    if (context==NULL) {
-		context = (uint2*)malloc(length*sizeof(uint2));
-		if (context == NULL)
-			sz_error(SZ_NOMEM_SORT);
-	}
-	if (symbols==NULL) {
-		symbols = (unsigned char*)(malloc(length));
-		if (symbols == NULL)
-			sz_error(SZ_NOMEM_SORT);
-	}
+	context = (uint2*) sz_workget(w, SZW_CONTEXT, length*sizeof(uint2));
+	symbols = (unsigned char*) sz_workget(w, SZW_SYMBOLS, length);
 
 	// the following loop in assembler it would probably be a lot faster
   {	register unsigned char *tmp;
-	register uint4 ctx = (uint4)inout[length-4]<<8 | inout[length-5];
-	if (ctx == 0xffff)
-		*indexlast = length-1;
-	else
-		*indexlast = counters[ctx+1]-1;
+	register uint4 ctx;
 	ctx = (((uint4)inout[length-1] << 8 | inout[length-2]) << 8 |
 		    inout[length-3]) << 8 | inout[length-4];
 	for (tmp=inout; tmp<inout+length; tmp++)
@@ -523,18 +785,15 @@ void sz_srt_o4(unsigned char *inout, uint4 length, uint4 *indexlast)
 	*indexlast = counters[context[i]];
 	while (i--)
 		inout[--counters[context[i]]] = symbols[i];
-
-//	free(counters);
-//	free(context);
-//	free(symbols);
+	clearcontexts(counters, sym, nsym);
 }
 #endif
 
 
 #ifdef SZ_UNSRT_O4
 // an alternate backtransform for order 4 using hash tables
-void sz_unsrt_o4(unsigned char *in, unsigned char *out, uint4 length, uint4 indexlast,
-			   uint4 *counts)
+void sz_unsrt_o4(sz_workspace *w, unsigned char *in, unsigned char *out, uint4 length,
+			   uint4 indexlast, uint4 *counts)
 {	uint4 i, *contexts2, *contexts4, initcontext;
 	uint2 *lastseen;
 	unsigned char *loop, *endloop, nocounts;
@@ -655,7 +914,7 @@ void sz_unsrt_o4(unsigned char *in, unsigned char *out, uint4 length, uint4 inde
 
 #include "qsort_u4.c"
 
-void sz_srt_BW(unsigned char *inout, uint4 length, uint4 *indexfirst)
+void sz_srt_BW(sz_workspace *w, unsigned char *inout, uint4 length, uint4 *indexfirst)
 {	uint4 i, counts[256], counts1[256], *contextp, start;
 
 	for (i=0; i<256; i++)
@@ -666,9 +925,7 @@ void sz_srt_BW(unsigned char *inout, uint4 length, uint4 *indexfirst)
 	for (i=0; i<255; i++) 
 		counts1[i+1] = counts1[i] + counts[i];
 	
-	contextp = (uint4*) calloc(length, sizeof(uint4));
-	if (contextp == NULL)
-		sz_error(SZ_NOMEM_SORT);
+	contextp = (uint4*) sz_workget(w, SZW_CONTEXT, length*sizeof(uint4));
 
 	for (i=0; i<length; i++)
 		contextp[counts1[inout[i]]++] = i;
@@ -694,22 +951,17 @@ void sz_srt_BW(unsigned char *inout, uint4 length, uint4 *indexfirst)
 	contextp[*indexfirst] = inout[0];
 	for(i=0; i<length; i++)
 		inout[i] = contextp[i];
-
-	free(contextp);
 }
 
 
-void sz_unsrt_BW(unsigned char *in, unsigned char *out, uint4 length,
-			   uint4 indexfirst, uint4 *counts)
-{	uint4 i, *transvec;
-	unsigned char nocounts;
+void sz_unsrt_BW(sz_workspace *w, unsigned char *in, unsigned char *out, uint4 length,
+			   uint4 indexfirst, uint4 *counts, uint4 outlength, unsigned int recordsize)
+{	uint4 i, *transvec, owncounts[256];
 
 	// get counts if not supplied
-	nocounts = counts==NULL;
-	if (nocounts)
-	{	counts = (uint4*) calloc(256, sizeof(uint4));
-		if (counts == NULL)
-			sz_error(SZ_NOMEM_SORT);
+	if (counts==NULL)
+	{	counts = owncounts;
+		memset(counts, 0, 256*sizeof(uint4));
 		for (i=0; i<length; i++)
 			counts[in[i]]++;
 	}
@@ -722,9 +974,7 @@ void sz_unsrt_BW(unsigned char *in, unsigned char *out, uint4 length,
   }
 
 	// prepare transposition vector
-	transvec = (uint4*)malloc((length)*sizeof(uint4));
-	if (transvec == NULL)
-		sz_error(SZ_NOMEM_SORT);
+	transvec = (uint4*) sz_workget(w, SZW_TABLE, length*sizeof(uint4));
 
 	transvec[indexfirst] = counts[in[indexfirst]]++;
 	for (i=0; i<indexfirst; i++)
@@ -732,25 +982,25 @@ void sz_unsrt_BW(unsigned char *in, unsigned char *out, uint4 length,
 	for (i=indexfirst+1; i<length; i++)
 		transvec[i] = counts[in[i]]++;
 
-
-	if (nocounts)
-		free(counts);
-
 	// undo the blocksort
   {	uint4 ic=indexfirst;
-	if (out==NULL)
-		for (i=0; i<length; i++)
+	if (recordsize != 1)
+	{	UNSRTPLACE(
+			c = (c & delta) + in[ic];
+			ic = transvec[ic])
+	}
+	else if (out==NULL)
+		for (i=0; i<outlength; i++)
 		{	putc(in[ic], stdout);
 			ic = transvec[ic];
 		}
 	else
-		for (i=0; i<length; i++)
+		for (i=0; i<outlength; i++)
 		{	out[i] = in[ic];
 			ic = transvec[ic];
 		}
-	if (ic != indexfirst)
+	if (outlength == length && ic != indexfirst)
 		sz_error(SZ_NOTCYCLIC);
   }
-	free(transvec);
 }
 #endif
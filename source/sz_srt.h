@@ -19,13 +19,88 @@
 #include "port.h"
 
 
+// The workspace holds the buffers the sorters and unsorters (and their
+// callers) keep from block to block. Each coder has one: szip one, every
+// szlib stream its own; it is used by one thread at a time. A buffer grows
+// to the largest block seen, so blocks of mixed sizes are fine; after
+// sz_workreserve blocks up to that size are coded without allocating.
+typedef void *(*sz_allocfunc)(void *opaque, size_t size);
+typedef void (*sz_freefunc)(void *opaque, void *ptr);
+
+enum {
+	SZW_SAVE,		// caller: copy of the block
+	SZW_TMP,		// caller: reorder and unreorder
+	SZW_INDEX, SZW_OLDINDEX, SZW_BLOCKS, SZW_SPARE,	// sz_srt pointer blocks
+	SZW_COUNTS,		// order 2 counters of sz_srt and sz_srt_o4, kept zero
+	SZW_CONTEXT,	// sz_srt_o4 and sz_srt_BW
+	SZW_SYMBOLS,	// sz_srt_o4
+	SZW_AUTO,		// sz_bestorder
+	SZW_TABLE,		// sz_unsrt and sz_unsrt_BW
+	SZW_FLAGS1, SZW_FLAGS2,	// sz_unsrt
+	SZW_PAIRS,		// incompressible (reorder.c)
+	SZW_BUFFERS
+};
+
+// The sorters and unsorters access their large buffers at random, so
+// TLB misses cost a lot there. With huge set (and alloc NULL) buffers of
+// SZ_HUGEMIN bytes and more are mapped with 2 MB pages and pre-faulted
+// (unix only; without huge pages from the system they get small ones).
+#define SZ_HUGE_OFF	0
+#define SZ_HUGE_THP	1		// transparent huge pages (madvise)
+#define SZ_HUGE_TLB	2		// hugetlbfs pages if reserved, else as SZ_HUGE_THP
+#define SZ_HUGEMIN	0x100000
+
+typedef struct {
+	void *buf[SZW_BUFFERS];
+	size_t size[SZW_BUFFERS];
+	unsigned char mapped[SZW_BUFFERS];	// buf is mapped with huge pages
+	uint4 extraspare;		// pointer blocks sz_srt had to add before
+	int huge;				// SZ_HUGE_*, set before the buffers are taken
+	sz_allocfunc alloc;		// NULL: malloc
+	sz_freefunc free;		// NULL: free
+	void *opaque;			// passed to alloc and free
+} sz_workspace;
+
+// an empty workspace; allocfn and freefn may be NULL for malloc and free
+void sz_workinit(sz_workspace *w, sz_allocfunc allocfn, sz_freefunc freefn, void *opaque);
+
+// size the buffers for sorting (compress) blocks of up to maxblock bytes
+// with order, or for unsorting them (!compress; order 0 needs less than
+// the others); sz_bestorder and the
+// caller's SZW_SAVE and SZW_TMP are not included. 1 if out of memory
+int sz_workreserve(sz_workspace *w, uint4 maxblock, unsigned int order, int compress);
+
+// the bytes sz_workreserve takes in an empty workspace (without huge pages)
+size_t sz_workneed(uint4 maxblock, unsigned int order, int compress);
+
+// make buffer which at least size bytes, as sz_workget; 1 if out of memory
+int sz_workgrow(sz_workspace *w, int which, size_t size);
+
+// buffer which of at least size bytes; if it has to grow its contents are
+// lost (a new SZW_COUNTS is zero). Out of memory is fatal (sz_error)
+void *sz_workget(sz_workspace *w, int which, size_t size);
+
+// free all buffers; w can be used again
+void sz_workfree(sz_workspace *w);
+
+
 // inout: bytes to be sorted; sorted bytes on return. must be length+order bytes long
 // length: number of bytes in inout
 // *indexlast: returns position of last context (needed for unsort)
 // order: order of context used in sorting (must be >=3)
 // the code assumes length>=order
 // and inout is length+order bytes long (only the first length need to be filled)
-void sz_srt(unsigned char *inout, uint4 length, uint4 *indexlast, unsigned int order);
+void sz_srt(sz_workspace *w, unsigned char *inout, uint4 length, uint4 *indexlast,
+			unsigned int order);
+
+
+// estimates the best of the orders 3, 4, 6, 8 and 12 for sz_srt
+// in: bytes to be sorted
+// length: number of bytes in in; the order returned is less than length if possible
+// breaks: returns the number of run breaks for each order (AUTOORDERS);
+//   large blocks are sampled and the breaks counted on the sample only
+#define AUTOORDERS 5
+unsigned int sz_bestorder(sz_workspace *w, unsigned char *in, uint4 length, uint4 *breaks);
 
 
 // in: bytes to be unsorted
@@ -34,9 +109,14 @@ void sz_srt(unsigned char *inout, uint4 length, uint4 *indexlast, unsigned int o
 // indexlast: position of last context (as returned bt sorttrans)
 // counts: number of occurances of each byte in in (if NULL it will be calculated)
 // order: order of context used in sorting (must be >=3)
+// outlength: number of bytes to output; if less than length unsorting stops early
+// recordsize: recordsize (1-127) and -i flag (0x80) of the block; the bytes are
+//   written to their place in the records (unreorder) as running sums (undodelta)
+//   in the same pass. With out NULL only the -i flag may be given
 // the code assumes length>=order
-void sz_unsrt(unsigned char *in, unsigned char *out, uint4 length, uint4 indexlast,
-			   uint4 *counts, unsigned int order);
+void sz_unsrt(sz_workspace *w, unsigned char *in, unsigned char *out, uint4 length,
+			   uint4 indexlast, uint4 *counts, unsigned int order, uint4 outlength,
+			   unsigned int recordsize);
 
 
 // comment the following #defines if you dont want them
@@ -46,23 +126,24 @@ void sz_unsrt(unsigned char *in, unsigned char *out, uint4 length, uint4 indexla
 
 // alternate sorter for order 4 (different method, same result)
 #if defined SZ_SRT_O4
-void sz_srt_o4(unsigned char *inout, uint4 length, uint4 *indexlast);
+void sz_srt_o4(sz_workspace *w, unsigned char *inout, uint4 length, uint4 *indexlast);
 #endif
 
 
 // alternate unsorter for order 4 (different method (hash), same result)
 #if defined SZ_UNSRT_O4
-void sz_unsrt_o4(unsigned char *in, unsigned char *out, uint4 length, uint4 indexlast,
-				 uint4 *counts);
+void sz_unsrt_o4(sz_workspace *w, unsigned char *in, unsigned char *out, uint4 length,
+				 uint4 indexlast, uint4 *counts);
 #endif
 
 
 #if defined SZ_SRT_BW
 // unlimited context sort (BWT but with context before symbol)
-void sz_srt_BW(unsigned char *inout, uint4 length, uint4 *indexfirst);
+void sz_srt_BW(sz_workspace *w, unsigned char *inout, uint4 length, uint4 *indexfirst);
 
 // unsorter for unlimited context sort
-void sz_unsrt_BW(unsigned char *in, unsigned char *out, uint4 length,
-			   uint4 indexfirst, uint4 *counts);
+// outlength and recordsize as for sz_unsrt
+void sz_unsrt_BW(sz_workspace *w, unsigned char *in, unsigned char *out, uint4 length,
+			   uint4 indexfirst, uint4 *counts, uint4 outlength, unsigned int recordsize);
 #endif
 #endif
@@ -0,0 +1,868 @@
+/*  szarc.c     multi-file archives (szip -a)
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* This file is part of szip.c; comp.c includes it after szip.c and it
+* uses the block readers and writers from there. The format of the
+* block directory is described in szarc.h.
+*
+* An archive is created by collecting all files first (the entries of
+* a directory sorted by name) and cutting the concatenation of their
+* data into blocks of the blocksize. So small files share a block and
+* large files are split. The blocks are independent and are compressed
+* by several processes; to extract single files only the blocks with
+* their data are decoded.
+*/
+
+#include "szarc.h"
+#ifdef unix
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
+#include <errno.h>
+#include <fcntl.h>
+#endif
+
+arcentry *arcentries=NULL;
+uint4 narcentries=0;
+static uint4 arcentriesalloc=0;
+static unsigned char *arcdir=NULL;   /* the entries as read */
+static uint4 arcdiralloc=0;
+static uint4 arcerrors=0;            /* files not archived or extracted */
+
+
+/* make sure (*p)[n] exists in an array of elements of size bytes */
+static void *arcgrow(void *p, uint4 *alloc, uint4 n, size_t size)
+{   if (n < *alloc)
+        return p;
+    while (n >= *alloc)
+        *alloc = *alloc ? 2 * *alloc : 256;
+    p = realloc(p, *alloc*size);
+    if (p==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    return p;
+}
+
+
+/* parse the entries in d[0..len-1]; returns their size including */
+/* the terminating 0, or 0 if they do not fit; fills arcentries   */
+/* if fill is set                                                 */
+static uint4 parsearcdir(unsigned char *d, uint4 len, int fill)
+{   uint4 i=0, name;
+    unsigned char flags;
+    if (fill)
+        narcentries = 0;
+    while (i < len && d[i] != 0)
+    {   name = i;
+        while (i < len && d[i] != 0)
+            i++;
+        if (i+5 > len)
+            return 0;
+        flags = d[i+1];
+        if (fill)
+        {   arcentry *e;
+            arcentries = (arcentry*) arcgrow(arcentries, &arcentriesalloc,
+                narcentries, sizeof(arcentry));
+            e = arcentries + narcentries++;
+            e->name = (char*)d + name;
+            e->flags = flags;
+            e->length = GET3(d+i+2);
+        }
+        i += 5;
+        if (!(flags & FL_CONT))
+        {   if (i+ARCATTRSIZE > len)
+                return 0;
+            if (fill)
+            {   arcentry *e = arcentries + narcentries-1;
+                e->mode = (uint4)d[i]<<8 | d[i+1];
+                e->uid = GET4(d+i+2);
+                e->gid = GET4(d+i+6);
+                e->mtime = GET4(d+i+10);
+                e->atime = GET4(d+i+14);
+                e->size = (uint8)GET4(d+i+18)<<32 | GET4(d+i+22);
+            }
+            i += ARCATTRSIZE;
+        }
+    }
+    return i < len ? i+1 : 0;
+}
+
+
+uint readarcdir()
+{   uint4 n=0, start, count;
+    int ch;
+    while (1)
+    {   start = n;
+        do
+        {   ch = getchar();
+            if (ch == EOF || n >= MAXDIR) no_szip();
+            arcdir = (unsigned char*) arcgrow(arcdir, &arcdiralloc, n, 1);
+            arcdir[n++] = (unsigned char)ch;
+        } while (ch != 0);
+        if (n == start+1)   /* empty name */
+            break;
+        ch = getchar();
+        if (ch == EOF) no_szip();
+        count = ch & FL_CONT ? 3 : 3+ARCATTRSIZE;
+        arcdir = (unsigned char*) arcgrow(arcdir, &arcdiralloc, n+count, 1);
+        arcdir[n++] = (unsigned char)ch;
+        if (fread(arcdir+n, 1, count, stdin) != count) no_szip();
+        n += count;
+    }
+    parsearcdir(arcdir, n, 1);
+    return n;
+}
+
+
+uint memdirsize(unsigned char *in, uint4 len)
+{   uint4 d;
+    if (len < 7)
+        return 0;
+    d = parsearcdir(in+5, len-5, 0);
+    return d ? 5+d : 0;
+}
+
+
+/* names given for extraction; all files if nselect==0 */
+static char **arcselect=NULL;
+static int nselect=0, *arcfound=NULL;
+
+/* 1 if name is one of arcselect or below one of them */
+static int selected(char *name)
+{   int i, hit=0;
+    size_t l;
+    if (nselect == 0)
+        return 1;
+    for (i=0; i<nselect; i++)
+    {   l = strlen(arcselect[i]);
+        if (strncmp(name, arcselect[i], l) == 0 && (name[l] == 0 || name[l] == '/'))
+        {   arcfound[i] = 1;
+            hit = 1;
+        }
+    }
+    return hit;
+}
+
+
+int arcwanted()
+{   uint4 i;
+    for (i=0; i<narcentries; i++)
+        if (selected(arcentries[i].name))
+            return 1;
+    return 0;
+}
+
+
+/* the name a path gets in the archive: no leading /, ./ or ../ */
+static char *arcname(char *path)
+{   while (1)
+        if (path[0] == '/')
+            path++;
+        else if (path[0] == '.' && path[1] == '/')
+            path += 2;
+        else if (path[0] == '.' && path[1] == '.' && path[2] == '/')
+            path += 3;
+        else
+            break;
+    return path;
+}
+
+
+#ifdef unix
+
+/* a file to be archived */
+typedef struct {
+    char *path;             /* name on disk */
+    char *name;             /* name in the archive */
+    unsigned char type;     /* FT_FILE, FT_DIR or FT_LINK */
+    struct stat st;
+} arcfile;
+
+/* the part of a file stored in one block */
+typedef struct {
+    uint4 file;             /* index into arcfiles */
+    uint8 offset;           /* position of the part in the file */
+    uint4 length;
+    unsigned char flags;    /* FL_MORE, FL_CONT */
+} arcpart;
+
+static arcfile *arcfiles=NULL;
+static uint4 narcfiles=0, arcfilesalloc=0;
+static arcpart *arcparts=NULL;
+static uint4 narcparts=0, arcpartsalloc=0;
+static uint4 *arcblockparts=NULL;   /* index of the first part of each block */
+static uint4 narcblocks=0, arcblockpartsalloc=0;
+static struct stat arcself;         /* the archive, not to be archived */
+
+static void addpath(char *path);
+
+static int cmpnames(const void *a, const void *b)
+{   return strcmp(*(char**)a, *(char**)b);
+}
+
+
+/* add the entries of directory path sorted by name */
+static void adddir(char *path)
+{   DIR *d;
+    struct dirent *de;
+    char **names=NULL, *p;
+    uint4 n=0, alloc=0, i;
+    size_t len = strlen(path);
+    d = opendir(path);
+    if (d == NULL)
+    {   perror(path);
+        arcerrors++;
+        return;
+    }
+    while ((de = readdir(d)) != NULL)
+    {   if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        p = (char*) malloc(len+strlen(de->d_name)+2);
+        if (p==NULL)
+        {   fprintf(stderr, "memory allocation error\n");
+            exit(1);
+        }
+        sprintf(p, "%s%s%s", path, len && path[len-1] == '/' ? "" : "/", de->d_name);
+        names = (char**) arcgrow(names, &alloc, n, sizeof(char*));
+        names[n++] = p;
+    }
+    closedir(d);
+    if (n)
+        qsort(names, n, sizeof(char*), cmpnames);
+    for (i=0; i<n; i++)
+        addpath(names[i]);
+    free(names);
+}
+
+
+/* add path and, if it is a directory, everything below it */
+static void addpath(char *path)
+{   arcfile *f;
+    struct stat st;
+    char *name = arcname(path);
+    if (lstat(path, &st) != 0)
+    {   perror(path);
+        arcerrors++;
+        return;
+    }
+    if (st.st_dev == arcself.st_dev && st.st_ino == arcself.st_ino)
+        return;
+    if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode) && !S_ISLNK(st.st_mode))
+    {   fprintf(stderr, "%s: not a file, directory or link; skipped\n", path);
+        return;
+    }
+    if (strlen(name) > MAXDIR/16)
+    {   fprintf(stderr, "%s: name too long; skipped\n", path);
+        arcerrors++;
+        return;
+    }
+    if (*name != 0 && strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+    {   arcfiles = (arcfile*) arcgrow(arcfiles, &arcfilesalloc, narcfiles, sizeof(arcfile));
+        f = arcfiles + narcfiles++;
+        f->path = path;
+        f->name = name;
+        f->type = S_ISDIR(st.st_mode) ? FT_DIR : S_ISLNK(st.st_mode) ? FT_LINK : FT_FILE;
+        f->st = st;
+        if (f->type == FT_DIR)
+            f->st.st_size = 0;
+    }
+    if (S_ISDIR(st.st_mode))
+        adddir(path);
+}
+
+
+static void addpart(uint4 file, uint8 offset, uint4 length, unsigned char flags)
+{   arcpart *p;
+    arcparts = (arcpart*) arcgrow(arcparts, &arcpartsalloc, narcparts, sizeof(arcpart));
+    p = arcparts + narcparts++;
+    p->file = file;
+    p->offset = offset;
+    p->length = length;
+    p->flags = flags;
+}
+
+
+static void startblock()
+{   arcblockparts = (uint4*) arcgrow(arcblockparts, &arcblockpartsalloc,
+        narcblocks+1, sizeof(uint4));
+    arcblockparts[narcblocks++] = narcparts;
+}
+
+
+/* cut the data of all files into blocks of blocksize; the block    */
+/* directory stays below MAXDIR and links are never split           */
+static void planblocks()
+{   uint4 i, fill=0, dir=0, entry, room, len;
+    for (i=0; i<narcfiles; i++)
+    {   arcfile *f = arcfiles+i;
+        uint8 left = f->st.st_size, offset = 0;
+        unsigned char flags = 0;
+        do
+        {   entry = strlen(f->name)+5 + (flags & FL_CONT ? 0 : ARCATTRSIZE);
+            if (narcblocks == 0 || dir+entry >= MAXDIR-1 ||
+                (fill == blocksize && left > 0) ||
+                (f->type == FT_LINK && left > blocksize-fill))
+            {   startblock();
+                fill = dir = 0;
+            }
+            room = blocksize-fill;
+            len = left < room ? (uint4)left : room;
+            addpart(i, offset, len, (unsigned char)(flags | (len < left ? FL_MORE : 0)));
+            fill += len;
+            dir += entry;
+            offset += len;
+            left -= len;
+            flags = FL_CONT;
+        } while (left > 0);
+    }
+    arcblockparts = (uint4*) arcgrow(arcblockparts, &arcblockpartsalloc,
+        narcblocks, sizeof(uint4));
+    arcblockparts[narcblocks] = narcparts;
+}
+
+
+/* read the data of block k into buffer; returns its length */
+static uint4 readarcdata(uint4 k, unsigned char *buffer)
+{   uint4 i, len=0;
+    size_t got;
+    for (i=arcblockparts[k]; i<arcblockparts[k+1]; i++)
+    {   arcpart *p = arcparts+i;
+        arcfile *f = arcfiles+p->file;
+        got = p->length;
+        if (f->type == FT_LINK)
+        {   if (readlink(f->path, (char*)buffer+len, p->length) != (ssize_t)p->length)
+                got = 0;
+        }
+        else if (f->type == FT_FILE && p->length)
+        {   FILE *in = fopen(f->path, "rb");
+            got = 0;
+            if (in != NULL)
+            {   if (FSEEK(in, p->offset, SEEK_SET) == 0)
+                    got = fread(buffer+len, 1, p->length, in);
+                fclose(in);
+            }
+        }
+        if (got != p->length)
+        {   fprintf(stderr, "%s: changed or unreadable while archiving\n", f->path);
+            memset(buffer+len+got, 0, p->length-got);
+            arcerrors++;
+        }
+        len += p->length;
+    }
+    return len;
+}
+
+
+/* write the directory of block k; returns its size */
+static uint writearcdir(uint4 k, uint4 buflen)
+{   uint4 i;
+    uint dirsize=6;
+    putchar(0x42);
+    putchar(0x48);
+    writeuint3(buflen);
+    for (i=arcblockparts[k]; i<arcblockparts[k+1]; i++)
+    {   arcpart *p = arcparts+i;
+        arcfile *f = arcfiles+p->file;
+        fputs(f->name, stdout);
+        putchar(0);
+        putchar(p->flags | f->type);
+        writeuint3(p->length);
+        dirsize += strlen(f->name)+5;
+        if (!(p->flags & FL_CONT))
+        {   putchar((f->st.st_mode>>8) & 0x0f);
+            putchar(f->st.st_mode & 0xff);
+            writeuint4(f->st.st_uid);
+            writeuint4(f->st.st_gid);
+            writeuint4(f->st.st_mtime);
+            writeuint4(f->st.st_atime);
+            writeuint4((uint4)((uint8)f->st.st_size>>32));
+            writeuint4((uint4)f->st.st_size);
+            dirsize += ARCATTRSIZE;
+        }
+    }
+    putchar(0);
+    return dirsize;
+}
+
+
+/* compress block k; returns the coded size, *buflen gets the uncoded */
+static uint4 arcblock(uint4 k, unsigned char *buffer, uint4 *buflen)
+{   uint4 coded;
+    uint dirsize, szipblock;
+    bstat.nr = k;
+    statphase(PH_IO);
+    *buflen = readarcdata(k, buffer);
+    dirsize = writearcdir(k, *buflen);
+    szipblock = *buflen>order && *buflen>5;
+    coded = writeblock(dirsize, *buflen, buffer, &szipblock);
+    statblock(szipblock, *buflen, coded);
+    if (verbosity&1) fprintf(stderr," done\n");
+    return coded;
+}
+
+
+static int readall(int fd, unsigned char *b, uint4 n)
+{   ssize_t r;
+    while (n > 0)
+    {   r = read(fd, b, n);
+        if (r <= 0)
+            return 0;
+        b += r;
+        n -= r;
+    }
+    return 1;
+}
+
+
+static int writeall(int fd, unsigned char *b, uint4 n)
+{   ssize_t r;
+    while (n > 0)
+    {   r = write(fd, b, n);
+        if (r <= 0)
+            return 0;
+        b += r;
+        n -= r;
+    }
+    return 1;
+}
+
+
+/* the job w of arcjobs: compresses its blocks into a temporary file */
+/* and sends each as coded size, uncoded size and the coded data     */
+static void arcjob(uint4 w, int out, unsigned char *buffer)
+{   FILE *tmp = tmpfile();
+    unsigned char *coded=NULL, h[8];
+    uint4 k, len, buflen, alloc=0;
+    if (tmp == NULL || dup2(fileno(tmp), fileno(stdout)) < 0)
+    {   perror("szip");
+        _exit(1);
+    }
+    for (k=w; k<narcblocks; k+=jobs)
+    {   rewind(stdout);
+        len = arcblock(k, buffer, &buflen);
+        fflush(stdout);
+        coded = (unsigned char*) arcgrow(coded, &alloc, len, 1);
+        if (pread(fileno(stdout), coded, len, 0) != (ssize_t)len)
+            _exit(1);
+        h[0] = len>>24; h[1] = len>>16; h[2] = len>>8; h[3] = len;
+        h[4] = buflen>>24; h[5] = buflen>>16; h[6] = buflen>>8; h[7] = buflen;
+        if (!writeall(out, h, 8) || !writeall(out, coded, len))
+            _exit(1);
+    }
+    _exit(arcerrors ? 2 : 0);
+}
+
+
+/* compress the blocks with jobs processes; job k%jobs does block k  */
+/* and the blocks are written in order as they come from the pipes   */
+static void arcjobs(unsigned char *buffer)
+{   int *fd, p[2], status, failed=0;
+    uint4 k, w, len, buflen, alloc=0;
+    unsigned char *coded=NULL, h[8];
+    pid_t pid;
+    fd = (int*) malloc(jobs*sizeof(int));
+    if (fd==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    for (w=0; w<jobs; w++)
+    {   if (pipe(p) != 0 || (pid = fork()) < 0)
+        {   perror("szip");
+            exit(1);
+        }
+        if (pid == 0)
+        {   close(p[0]);
+            for (k=0; k<w; k++)
+                close(fd[k]);
+            arcjob(w, p[1], buffer);
+        }
+        close(p[1]);
+        fd[w] = p[0];
+    }
+    for (k=0; k<narcblocks; k++)
+    {   if (!readall(fd[k%jobs], h, 8))
+            break;
+        len = GET4(h);
+        buflen = GET4(h+4);
+        coded = (unsigned char*) arcgrow(coded, &alloc, len, 1);
+        if (!readall(fd[k%jobs], coded, len))
+            break;
+        if (fwrite(coded, 1, len, stdout) != len)
+        {   fprintf(stderr, "Error writing output\n");
+            exit(1);
+        }
+        if (seekable)
+            addindex(buflen, len, NULL);
+    }
+    for (w=0; w<jobs; w++)
+        close(fd[w]);
+    while (wait(&status) > 0)
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 2)
+            arcerrors++;
+        else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    if (failed || k < narcblocks)
+    {   fprintf(stderr, "a compression job failed\n");
+        exit(1);
+    }
+    free(coded);
+    free(fd);
+}
+
+
+void compressarchive(char **names, int n)
+{   unsigned char *buffer;
+    uint4 k, buflen, coded;
+    int i;
+    if (fstat(fileno(stdout), &arcself) != 0)
+        memset(&arcself, 0, sizeof(arcself));
+    if (jobs == 0)
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    /* the blocks are planned for blocksize, so -m has to shrink it first */
+    fitcompress(&jobs, jobs > 1);
+    for (i=0; i<n; i++)
+        addpath(names[i]);
+    planblocks();
+
+    buffer = (unsigned char*) malloc(blocksize+order+1);
+    if (buffer==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    writeglobalheader();
+    if (jobs > narcblocks)
+        jobs = narcblocks;
+    if (jobs > 1)
+        arcjobs(buffer);
+    else
+        for (k=0; k<narcblocks; k++)
+        {   coded = arcblock(k, buffer, &buflen);
+            if (seekable)
+                addindex(buflen, coded, NULL);
+        }
+    if (seekable)
+        writeindex();
+    free(buffer);
+    if (fflush(stdout) != 0)
+    {   fprintf(stderr, "Error writing output\n");
+        exit(1);
+    }
+    if (arcerrors)
+    {   fprintf(stderr, "%lu files could not be archived completely\n",
+            (unsigned long)arcerrors);
+        exit(1);
+    }
+}
+
+
+/* extraction: the file being written and its attributes */
+static FILE *arcout=NULL;
+static arcentry arcattr;           /* name is NULL if the file is skipped */
+/* the attributes of directories are set at the end */
+static arcentry *arcdirs=NULL;
+static uint4 narcdirs=0, arcdirsalloc=0;
+
+
+/* a name from the archive must not leave the current directory */
+static int safename(char *name)
+{   char *s = name;
+    if (*name == '/')
+        return 0;
+    while (s != NULL)
+    {   if (s[0] == '.' && s[1] == '.' && (s[2] == 0 || s[2] == '/'))
+            return 0;
+        s = strchr(s, '/');
+        if (s != NULL)
+            s++;
+    }
+    return 1;
+}
+
+
+/* create the directories leading to name; 0 if one of them is a */
+/* symbolic link (the archive may have made it point anywhere)     */
+static int mkparents(char *name)
+{   struct stat st;
+    char *s;
+    int ok = 1;
+    for (s=strchr(name, '/'); s != NULL && ok; s=strchr(s+1, '/'))
+    {   *s = 0;
+        if (lstat(name, &st) == 0)
+            ok = !S_ISLNK(st.st_mode);
+        else
+            mkdir(name, 0777);
+        *s = '/';
+    }
+    return ok;
+}
+
+
+static void setattr(arcentry *e)
+{   struct utimbuf t;
+    struct stat st;
+    if ((e->flags & FT_MASK) == FT_LINK)
+    {   if (geteuid() == 0 && lchown(e->name, e->uid, e->gid) != 0)
+            perror(e->name);
+        return;
+    }
+    /* chmod, chown and utime follow links */
+    if (lstat(e->name, &st) != 0 || S_ISLNK(st.st_mode))
+    {   fprintf(stderr, "%s: replaced by a symbolic link; attributes not set\n", e->name);
+        arcerrors++;
+        return;
+    }
+    if (geteuid() == 0 && chown(e->name, e->uid, e->gid) != 0)
+        perror(e->name);
+    if (chmod(e->name, e->mode & 07777) != 0)
+        perror(e->name);
+    t.actime = e->atime;
+    t.modtime = e->mtime;
+    if (utime(e->name, &t) != 0)
+        perror(e->name);
+}
+
+
+/* start extracting entry e; data holds its first e->length bytes */
+static void startentry(arcentry *e, unsigned char *data)
+{   int type = e->flags & FT_MASK;
+    char *target;
+    arcattr = *e;
+    arcattr.name = NULL;
+    if (!selected(e->name))
+        return;
+    if (!safename(e->name))
+    {   fprintf(stderr, "%s: unsafe name; skipped\n", e->name);
+        arcerrors++;
+        return;
+    }
+    arcattr.name = (char*) malloc(strlen(e->name)+1);
+    if (arcattr.name==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    strcpy(arcattr.name, e->name);
+    if (verbosity)
+        fprintf(stderr, "%s\n", arcattr.name);
+    if (!mkparents(arcattr.name))
+    {   fprintf(stderr, "%s: path through a symbolic link; skipped\n", arcattr.name);
+        arcerrors++;
+        free(arcattr.name);
+        arcattr.name = NULL;
+        return;
+    }
+    if (type == FT_DIR)
+    {   if (mkdir(arcattr.name, 0700) != 0 && errno != EEXIST)
+        {   perror(arcattr.name);
+            arcerrors++;
+        }
+        arcdirs = (arcentry*) arcgrow(arcdirs, &arcdirsalloc, narcdirs, sizeof(arcentry));
+        arcdirs[narcdirs++] = arcattr;
+        arcattr.name = NULL;
+        return;
+    }
+    unlink(arcattr.name);
+    if (type == FT_LINK)
+    {   target = (char*) malloc(e->length+1);
+        if (target==NULL)
+        {   fprintf(stderr, "memory allocation error\n");
+            exit(1);
+        }
+        memcpy(target, data, e->length);
+        target[e->length] = 0;
+        if (symlink(target, arcattr.name) != 0 || (e->flags & FL_MORE))
+        {   perror(arcattr.name);
+            arcerrors++;
+        }
+        free(target);
+    }
+    else
+    {   /* O_NOFOLLOW: not through a link put there since the unlink */
+        int fd = open(arcattr.name, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW, 0666);
+        arcout = fd < 0 ? NULL : fdopen(fd, "wb");
+        if (arcout == NULL)
+        {   perror(arcattr.name);
+            arcerrors++;
+            free(arcattr.name);
+            arcattr.name = NULL;
+        }
+    }
+}
+
+
+static void endentry()
+{   if (arcout != NULL)
+    {   if (fclose(arcout) != 0)
+        {   perror(arcattr.name);
+            arcerrors++;
+        }
+        arcout = NULL;
+    }
+    if (arcattr.name != NULL)
+    {   setattr(&arcattr);
+        free(arcattr.name);
+        arcattr.name = NULL;
+    }
+}
+
+
+void arcwrite(unsigned char *data, uint4 len)
+{   uint4 i;
+    for (i=0; i<narcentries; i++)
+    {   arcentry *e = arcentries+i;
+        if (e->length > len) no_szip();
+        if (!(e->flags & FL_CONT))
+        {   endentry();
+            startentry(e, data);
+        }
+        if (arcout != NULL && fwrite(data, 1, e->length, arcout) != e->length)
+        {   perror(arcattr.name);
+            exit(1);
+        }
+        data += e->length;
+        len -= e->length;
+        if (!(e->flags & FL_MORE))
+            endentry();
+    }
+    if (len != 0) no_szip();
+}
+
+
+/* extract the selected files block by block, skipping the others */
+static void extractselected()
+{   unsigned char *buffer;
+    uint4 i, blocklen, maxsize=1;
+    uint dirsize;
+    int ch;
+    findblocks();
+    for (i=0; i<nrblocks; i++)
+        if (blocklist[i].size > maxsize)
+            maxsize = blocklist[i].size;
+    buffer = (unsigned char *) malloc(maxsize);
+    if (buffer==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    for (i=0; i<nrblocks; i++)
+    {   FSEEK(stdin, blocklist[i].pos, SEEK_SET);
+        dirsize = readblockdir(&blocklen);
+        if (!arcwanted())
+            continue;
+        bstat.nr = i;
+        ch = getchar();
+        if (ch==0)
+            statblock(0, blocklen, readstorblock(dirsize+1, blocklen, buffer,
+                0, blocklen));
+        else if (ch==1 || ch==2)
+            statblock(1, blocklen, readszipblock(dirsize+1, blocklen, buffer,
+                0, blocklen, ch));
+        else
+            no_szip();
+        if (verbosity&1) fprintf(stderr," done\n");
+    }
+    free(buffer);
+}
+
+
+void extractarchive(char **names, int n)
+{   int i;
+    size_t l;
+    arcselect = names;
+    nselect = n;
+    arcfound = (int*) calloc(n+1, sizeof(int));
+    if (arcfound==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    for (i=0; i<n; i++)
+    {   names[i] = arcname(names[i]);
+        for (l=strlen(names[i]); l>0 && names[i][l-1]=='/'; l--)
+            names[i][l-1] = 0;
+    }
+    if (n > 0 && FSEEK(stdin, 0, SEEK_END) == 0)
+        extractselected();
+    else
+        decompressit();
+    endentry();
+    while (narcdirs > 0)   /* innermost first */
+    {   narcdirs--;
+        setattr(arcdirs+narcdirs);
+        free(arcdirs[narcdirs].name);
+    }
+    for (i=0; i<n; i++)
+        if (!arcfound[i])
+        {   fprintf(stderr, "%s: not in archive\n", names[i]);
+            arcerrors++;
+        }
+    if (arcerrors)
+        exit(1);
+}
+
+
+/* ls -l like mode string */
+static char *modestring(arcentry *e)
+{   static char s[11];
+    static const char *rwx = "rwxrwxrwx";
+    int i;
+    s[0] = (e->flags & FT_MASK) == FT_DIR ? 'd' : (e->flags & FT_MASK) == FT_LINK ? 'l' : '-';
+    for (i=0; i<9; i++)
+        s[i+1] = e->mode & (0400>>i) ? rwx[i] : '-';
+    s[10] = 0;
+    return s;
+}
+
+
+void listarchive()
+{   uint4 i, k, blocklen;
+    uint8 total=0, files=0;
+    char date[20];
+    findblocks();
+    for (k=0; k<nrblocks; k++)
+    {   FSEEK(stdin, blocklist[k].pos, SEEK_SET);
+        readblockdir(&blocklen);
+        for (i=0; i<narcentries; i++)
+        {   arcentry *e = arcentries+i;
+            time_t t = e->mtime;
+            if (e->flags & FL_CONT)
+                continue;
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&t));
+            printf("%s %5lu/%-5lu %12llu %s %s\n", modestring(e), (unsigned long)e->uid,
+                (unsigned long)e->gid, (unsigned long long)e->size, date, e->name);
+            total += e->size;
+            files++;
+        }
+    }
+    printf("%llu files, %llu bytes\n", (unsigned long long)files,
+        (unsigned long long)total);
+}
+
+#else   /* no unix: the archive directory is read but not handled */
+
+static void nounix()
+{   fprintf(stderr, "archives are supported on unix only\n");
+    exit(1);
+}
+
+void arcwrite(unsigned char *data, uint4 len) { nounix(); }
+void compressarchive(char **names, int n) { nounix(); }
+void extractarchive(char **names, int n) { nounix(); }
+void listarchive() { nounix(); }
+
+#endif
@@ -0,0 +1,84 @@
+/*  szarc.h     multi-file archives (szip -a)
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* The block directory ('B','H', uint3 blocklength) is followed by a
+* list of entries, terminated by an empty filename. A plain szip file
+* has no entries. In an archive the data of a block is the
+* concatenation of the file parts named in its entries:
+*
+*   filename   nonempty, terminated by 0
+*   flags      1 byte: FL_MORE, FL_CONT and the file type
+*   length     3 bytes: bytes of this file in the block
+*   attributes ARCATTRSIZE bytes, only if FL_CONT is not set:
+*              mode (2), uid (4), gid (4), mtime (4), atime (4),
+*              size of the whole file (8)
+*
+* All numbers are big endian. Small files share a block, large
+* files are split over consecutive blocks (FL_MORE/FL_CONT).
+*/
+#ifndef SZARC_H
+#define SZARC_H
+
+#include "port.h"
+
+#define FL_MORE 0x01     /* file continues in the next block */
+#define FL_CONT 0x02     /* file started in the previous block */
+#define FT_FILE 0x00     /* regular file */
+#define FT_DIR  0x10     /* directory, no data */
+#define FT_LINK 0x20     /* symbolic link, data is the target */
+#define FT_MASK 0x30
+
+#define ARCATTRSIZE 26
+#define MAXDIR 0x10000   /* limit for the entries of one block */
+
+/* one entry of a block directory */
+typedef struct {
+    char *name;
+    unsigned char flags;
+    uint4 length;        /* bytes of the file in this block */
+    uint4 mode, uid, gid, mtime, atime;
+    uint8 size;          /* size of the whole file */
+} arcentry;
+
+/* entries of the block directory read last */
+extern arcentry *arcentries;
+extern uint4 narcentries;
+
+/* read the entries after the blocklength from stdin */
+/* returns the number of bytes read, including the terminating 0 */
+uint readarcdir();
+
+/* size of the block directory of the block in memory at in, */
+/* 0 if it does not fit into len bytes                        */
+uint memdirsize(unsigned char *in, uint4 len);
+
+/* write the data of a decoded block to the files of its entries */
+void arcwrite(unsigned char *data, uint4 len);
+
+/* 1 if an entry of the current block directory is to be extracted */
+int arcwanted();
+
+/* compress the files and directory trees in names to stdout */
+void compressarchive(char **names, int n);
+
+/* extract the files in names (all if n==0) from stdin */
+void extractarchive(char **names, int n);
+
+/* list the files of the archive on stdin */
+void listarchive();
+
+#endif
@@ -0,0 +1,520 @@
+/* szbench.c - times the stages of szip on a generated corpus
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* For every combination of corpus, order and blocksize one block is
+* generated (always the same bytes for the same parameters), passed
+* through the same stages szip uses, decoded again and compared. It
+* also fails if the incompressible pre-check of szip would store a
+* block of any corpus but random.
+* Each stage is timed separately; the best of several repetitions is
+* reported. Every combination runs in its own process so the peak
+* resident set size belongs to that combination only. The exit code
+* is 1 if any combination failed or did not finish.
+*
+* The range coder writes to memory here, so no file IO is measured.
+* Cycles are read from the time stamp counter (x86 only).
+*
+* -H1 backs the large sorter buffers with transparent huge pages, -H2
+* with hugetlbfs pages (see sz_srt.h); make hugebench compares them.
+*
+* usage: szbench [-j] [-c<corpora>] [-o<orders>] [-b<blocksizes>] [-n<reps>]
+*                [-H<mode>]
+*/
+
+#define GLOBALRANGECODER
+#define MODELGLOBAL
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#if defined __i386__ || defined __x86_64__
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+/* range coder IO goes to memory */
+static unsigned char *bench_out, *bench_in, *bench_inend;
+#define outbyte(cod,x) (*bench_out++ = (unsigned char)(x))
+#define inbyte(cod)    (bench_in < bench_inend ? *bench_in++ : EOF)
+
+uint verbosity=0;   /* used by sz_srt_BW */
+
+#include "rangecod.c"
+#include "qsmodel.c"
+#ifdef VECMODEL
+#include "vecmodel.c"
+#else
+#include "bitmodel.c"
+#endif
+#include "sz_mod4.c"
+#include "sz_srt.c"
+#include "reorder.c"
+
+static sz_workspace work;   /* buffers of the sorter, kept between runs */
+
+/* stages in the order they run; unsort includes undelta and unreorder */
+enum {ST_REORDER, ST_DELTA, ST_SORT, ST_ENCODE, ST_DECODE, ST_UNSORT, ST_COUNT};
+static char *stagename[ST_COUNT] = {"reorder", "delta", "sort", "encode",
+    "decode", "unsort"};
+
+
+/************************** corpus ************************************/
+
+typedef struct {
+    char *name;
+    unsigned char recordsize;  /* as given to szip with -r and -i */
+    void (*make)(unsigned char *buf, uint4 length);
+} corpus;
+
+static uint4 rndstate;
+
+static uint4 rnd()
+{   rndstate ^= rndstate << 13;
+    rndstate ^= rndstate >> 17;
+    rndstate ^= rndstate << 5;
+    return rndstate;
+}
+
+static char *words[] = {"the", "of", "and", "to", "a", "in", "is", "that",
+    "for", "it", "as", "was", "with", "be", "by", "on", "not", "he", "this",
+    "are", "or", "his", "from", "at", "which", "but", "have", "an", "had",
+    "they", "you", "were", "their", "one", "all", "we", "can", "her", "has",
+    "there", "been", "if", "more", "when", "will", "would", "who", "so",
+    "block", "sorting", "context", "model", "symbol", "frequency", "range",
+    "compression", "order", "probability", "cache", "transform", "buffer",
+    "record", "history", "decoder"};
+
+static void maketext(unsigned char *buf, uint4 length)
+{   uint4 i=0, col=0, cap=1;
+    while (i<length)
+    {   double u = (rnd() & 0xffff) / 65536.0;
+        char *w = words[(int)(u*u*u * (sizeof(words)/sizeof(char*)))];
+        while (*w && i<length)
+        {   buf[i++] = cap ? toupper(*w) : *w;
+            w++;
+            col++;
+            cap = 0;
+        }
+        if (i<length && (rnd()&15) == 0)
+        {   buf[i++] = (rnd()&3) ? ',' : '.';
+            cap = buf[i-1] == '.';
+        }
+        if (i<length)
+        {   buf[i++] = col>68 ? '\n' : ' ';
+            if (col>68) col = 0;
+        }
+    }
+}
+
+static void makebinary(unsigned char *buf, uint4 length)
+{   static char *names[8] = {"alpha\0\0\0", "beta\0\0\0\0", "gamma\0\0\0",
+        "delta\0\0\0", "epsilon\0", "zeta\0\0\0\0", "eta\0\0\0\0\0", "theta\0\0\0"};
+    uint4 i, id=0, stamp=900000000;
+    float value=100.0f;
+    unsigned char rec[24];
+    for (i=0; i<length; i++)
+    {   if (i%24 == 0)
+        {   uint4 fbits;
+            stamp += 17 + (rnd()&7);
+            value += ((int)(rnd()&255)-128) / 64.0f;
+            memcpy(&fbits, &value, 4);
+            rec[0]=id; rec[1]=id>>8; rec[2]=id>>16; rec[3]=id>>24;
+            rec[4]=stamp; rec[5]=stamp>>8; rec[6]=stamp>>16; rec[7]=stamp>>24;
+            rec[8]=rnd()&7; rec[9]=0;
+            rec[10]=(rnd()&31)==0; rec[11]=0;
+            rec[12]=fbits; rec[13]=fbits>>8; rec[14]=fbits>>16; rec[15]=fbits>>24;
+            memcpy(rec+16, names[rnd()&7], 8);
+            id++;
+        }
+        buf[i] = rec[i%24];
+    }
+}
+
+static void makerepetitive(unsigned char *buf, uint4 length)
+{   static char *lines[] = {
+        "INFO  request served path=/api/v1/items status=200 ms=",
+        "INFO  request served path=/api/v1/users status=200 ms=",
+        "WARN  slow query table=orders rows=",
+        "INFO  cache hit key=session:",
+        "INFO  cache miss key=session:",
+        "DEBUG heartbeat from node-",
+        "ERROR upstream timeout host=10.0.0.",
+        "INFO  request served path=/static/app.js status=304 ms="};
+    uint4 i=0, t=0;
+    while (i<length)
+    {   char line[128];
+        int n;
+        t += rnd()&63;
+        n = sprintf(line, "2026-01-01T%02u:%02u:%02u.%03u ",
+            (t/3600000)%24, (t/60000)%60, (t/1000)%60, t%1000);
+        n += sprintf(line+n, "%s%u\n", lines[rnd()&7], rnd()%(1+(rnd()&1023)));
+        if ((uint4)n > length-i) n = length-i;
+        memcpy(buf+i, line, n);
+        i += n;
+    }
+}
+
+static void makerandom(unsigned char *buf, uint4 length)
+{   uint4 i;
+    for (i=0; i<length; i++)
+        buf[i] = rnd() >> 24;
+}
+
+static void makeaudio(unsigned char *buf, uint4 length)
+{   uint4 i;
+    double phase1=0, phase2=0, f1=0.031, f2=0.0047;
+    for (i=0; i+1<length; i+=2)
+    {   int s;
+        phase1 += f1;
+        phase2 += f2;
+        if ((i & 0xffff) == 0)
+            f1 = 0.01 + (rnd() & 0xff) / 4096.0;
+        s = (int)(9000*sin(phase1) + 6000*sin(phase2)) + (int)(rnd()&127) - 64;
+        buf[i] = s & 0xff;
+        buf[i+1] = (s >> 8) & 0xff;
+    }
+    if (i<length)
+        buf[i] = 0;
+}
+
+static void makeimage(unsigned char *buf, uint4 length)
+{   uint4 i;
+    for (i=0; i<length; i++)
+    {   uint4 pixel = i/3, x = pixel % 1024, y = pixel / 1024, c = i%3, v;
+        if (((x>>6) + (y>>6)) % 5 == 0)   /* flat areas */
+            v = 40 + 70*c;
+        else
+            v = (x*(c+1) + y*(3-c)) / 5 + (int)(24*sin(x/37.0 + y/23.0 + c));
+        buf[i] = (v + (rnd()&3)) & 0xff;
+    }
+}
+
+/* gradients that wrap around: byte by byte (and in pairs of neighbours) */
+/* the channels look random, only the pixel before tells                */
+static void makegradient(unsigned char *buf, uint4 length)
+{   uint4 i;
+    for (i=0; i<length; i++)
+    {   uint4 pixel = i/3, x = pixel % 1024, y = pixel / 1024, c = i%3;
+        buf[i] = ((2*c+1)*x + (7-3*c)*y + 50*c + (rnd()&1)) & 0xff;
+    }
+}
+
+static corpus corpora[] = {
+    {"text", 1, maketext},
+    {"binary", 1, makebinary},
+    {"repetitive", 1, makerepetitive},
+    {"random", 1, makerandom},
+    {"audio16", 2|0x80, makeaudio},
+    {"image24", 3, makeimage},
+    {"gradient24", 3, makegradient}};
+#define NCORPORA (sizeof(corpora)/sizeof(corpus))
+
+
+/************************** timing ************************************/
+
+typedef struct {
+    double seconds;
+    double cycles;     /* 0 if not available */
+} stagetime;
+
+static double now()
+{   struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static unsigned long long ticks()
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+#define TIMED(st, code) \
+  { double t0 = now(); unsigned long long c0 = ticks(); \
+    code; \
+    c0 = ticks()-c0; t0 = now()-t0; \
+    if (rep==0 || t0 < times[st].seconds) \
+    {   times[st].seconds = t0; times[st].cycles = (double)c0; } }
+
+
+/* one combination: run all stages reps times, keep the best times */
+/* returns 0 if the roundtrip and the pre-check were ok */
+static int runone(corpus *c, uint order, uint4 length, int reps,
+    stagetime *times, uint4 *packed)
+{   unsigned char *orig, *buf, *tmp, *coded;
+    unsigned char recordsize = c->recordsize;
+    uint r = recordsize & 0x7f;
+    int rep, ok = 1;
+
+    orig = (unsigned char*) malloc(length);
+    buf = (unsigned char*) malloc(length+order+1);
+    tmp = (unsigned char*) malloc(length+order+1);
+    coded = (unsigned char*) malloc(length + length/2 + 1024);
+    if (orig==NULL || buf==NULL || tmp==NULL || coded==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    rndstate = 0x2545f491;
+    c->make(orig, length);
+    memset(times, 0, ST_COUNT*sizeof(stagetime));
+    /* szip stores what the pre-check calls random without sorting; */
+    /* of the corpora only random may be                            */
+    if (incompressible(&work, orig, length) != (c->make == makerandom))
+        ok = 0;
+
+    for (rep=0; rep<reps; rep++)
+    {   uint4 indexlast, charcount[256];
+        unsigned char first;
+        memcpy(buf, orig, length);
+
+        /* compression */
+        if (r != 1)
+            TIMED(ST_REORDER, reorder(buf,tmp,length,r); memcpy(buf,tmp,length))
+        if (recordsize & 0x80)
+            TIMED(ST_DELTA, makedelta(buf,length))
+        TIMED(ST_SORT,
+            if (order==4)
+                sz_srt_o4(&work,buf,length,&indexlast);
+            else if (order==0)
+                sz_srt_BW(&work,buf,length,&indexlast);
+            else
+                sz_srt(&work,buf,length,&indexlast,order))
+        first = recordsize;
+        bench_out = coded;
+        TIMED(ST_ENCODE,
+            initmodel(&m, 0, &first, NULL);
+            sz_encodeblock(&m, buf, length);
+            deletemodel(&m))
+        *packed = bench_out - coded;
+
+        /* decompression */
+        bench_in = coded;
+        bench_inend = bench_out;
+        memset(charcount, 0, sizeof(charcount));
+        TIMED(ST_DECODE,
+            initmodel(&m, -1, &first, NULL);
+            if (sz_decodeblock(&m, buf, length, charcount))
+                ok = 0;
+            deletemodel(&m))
+        TIMED(ST_UNSORT,
+            if (order==0)
+                sz_unsrt_BW(&work, buf, tmp, length, indexlast, charcount, length,
+                    recordsize);
+            else
+                sz_unsrt(&work, buf, tmp, length, indexlast, charcount, order, length,
+                    recordsize))
+        if (first != recordsize || memcmp(tmp, orig, length) != 0)
+            ok = 0;
+    }
+    free(orig);
+    free(buf);
+    free(tmp);
+    free(coded);
+    return !ok;
+}
+
+
+/************************** reporting *********************************/
+
+static int json = 0;
+
+static void report(corpus *c, uint order, uint4 length, stagetime *times,
+    uint4 packed, int failed, long maxrss, int firstrecord)
+{   int st;
+    char *sep = "";
+    if (json)
+    {   printf("%s  {\"corpus\": \"%s\", \"order\": %u, \"blocksize\": %lu, "
+            "\"recordsize\": %u, \"incremental\": %s, \"compressed\": %lu, "
+            "\"roundtrip\": \"%s\", \"peak_rss_kb\": %ld, \"stages\": {",
+            firstrecord ? "" : ",\n", c->name, order, (unsigned long)length,
+            c->recordsize & 0x7f, c->recordsize & 0x80 ? "true" : "false",
+            (unsigned long)packed, failed ? "fail" : "ok", maxrss);
+        for (st=0; st<ST_COUNT; st++)
+        {   double s = times[st].seconds;
+            if (s==0) continue;
+            printf("%s\"%s\": {\"seconds\": %.6f, \"mb_per_s\": %.2f, "
+                "\"cycles_per_byte\": %.2f}", sep, stagename[st], s,
+                length/s/1e6, times[st].cycles/length);
+            sep = ", ";
+        }
+        printf("}}");
+    }
+    else
+    {   printf("%-10s -o%-3u %8lu %6.2f%% %s", c->name, order,
+            (unsigned long)length, 100.0*packed/length, failed ? "FAIL" : "ok  ");
+        for (st=0; st<ST_COUNT; st++)
+        {   double s = times[st].seconds;
+            if (s==0)
+                printf("  %15s", "-");
+            else
+                printf("  %7.1f %7.1f", length/s/1e6, times[st].cycles/length);
+        }
+        printf("  %8ld\n", maxrss);
+    }
+    fflush(stdout);
+}
+
+
+static void usage()
+{   fprintf(stderr, "usage: szbench [-j] [-c<corpora>] [-o<orders>] [-b<blocksizes>] [-n<reps>]\n"
+        "               [-H<mode>]\n");
+    fprintf(stderr, "-j               JSON output\n");
+    fprintf(stderr, "-c<list>         corpora, default all:");
+  { uint i;
+    for (i=0; i<NCORPORA; i++)
+        fprintf(stderr, "%c%s", i ? ',' : ' ', corpora[i].name);
+  }
+    fprintf(stderr, "\n-o<list>         orders, default 3,4,6,8,0\n");
+    fprintf(stderr, "-b<list>         blocksizes in 100kB, default 1,9,17\n");
+    fprintf(stderr, "-n<reps>         repetitions (best is reported), default 3\n");
+    fprintf(stderr, "-H<mode>         huge pages for the sorter: 0 off, 1 transparent, 2 hugetlbfs\n");
+    exit(1);
+}
+
+
+/* read a comma separated list of numbers */
+static int readlist(char *s, uint *list, int max, uint lo, uint hi)
+{   int n = 0;
+    while (*s)
+    {   uint j = 0;
+        if (!isdigit(*s) || n==max)
+            usage();
+        while (isdigit(*s))
+            j = 10*j + *(s++) - '0';
+        if (j<lo || j>hi)
+            usage();
+        list[n++] = j;
+        if (*s == ',')
+            s++;
+    }
+    return n;
+}
+
+
+int main(int argc, char *argv[])
+{   uint orders[16] = {3, 4, 6, 8, 0}, sizes[16] = {1, 9, 17};
+    int norders = 5, nsizes = 3, reps = 3, i, j, k, first = 1, errors = 0;
+    char *corpuslist = NULL;
+
+    for (i=1; i<argc; i++)
+    {   char *s = argv[i];
+        if (*s != '-') usage();
+        switch (s[1])
+        {   case 'j': json = 1; break;
+            case 'c': corpuslist = s+2; break;
+            case 'o': norders = readlist(s+2, orders, 16, 0, 255); break;
+            case 'b': nsizes = readlist(s+2, sizes, 16, 1, 41); break;
+            case 'n': reps = atoi(s+2); if (reps<1) usage(); break;
+            case 'H': work.huge = atoi(s+2); if (work.huge<0 || work.huge>2) usage(); break;
+            default: usage();
+        }
+    }
+    for (j=0; j<norders; j++)
+        if (orders[j]==1 || orders[j]==2)
+            usage();
+
+    if (json)
+        printf("{\"tsc\": %s, \"fullmodel\": \"%s\", \"hugepages\": %d, \"results\": [\n",
+#ifdef HAVE_TSC
+            "true",
+#else
+            "false",
+#endif
+#ifdef VECMODEL
+            "vecmodel",
+#else
+            "bitmodel",
+#endif
+            work.huge);
+    else
+    {   printf("%-10s %-5s %8s %7s %-4s", "corpus", "order", "bytes", "ratio", "");
+        for (k=0; k<ST_COUNT; k++)
+            printf("  %15s", stagename[k]);
+        printf("  %8s\n%42s", "peak kB", "");
+        for (k=0; k<ST_COUNT; k++)
+            printf("  %7s %7s", "MB/s", "c/B");
+        printf("\n");
+    }
+    fflush(stdout);
+
+    for (k=0; k<(int)NCORPORA; k++)
+    {   corpus *c = corpora+k;
+        if (corpuslist != NULL)
+        {   char *p = strstr(corpuslist, c->name);
+            size_t l = strlen(c->name);
+            if (p==NULL || (p!=corpuslist && p[-1]!=',') || (p[l] && p[l]!=','))
+                continue;
+        }
+        for (i=0; i<nsizes; i++)
+            for (j=0; j<norders; j++)
+            {   uint4 length = (100000*sizes[i]+0x7fff) & 0x7fff8000L;
+                int fds[2];
+                pid_t pid;
+                /* run in a child so peak RSS and the static buffers */
+                /* of the sorters are per combination */
+                if (pipe(fds) != 0 || (pid = fork()) < 0)
+                {   perror("szbench");
+                    exit(1);
+                }
+                if (pid == 0)
+                {   stagetime times[ST_COUNT];
+                    uint4 packed = 0;
+                    int failed;
+                    struct rusage ru;
+                    close(fds[0]);
+                    failed = runone(c, orders[j], length, reps, times, &packed);
+                    getrusage(RUSAGE_SELF, &ru);
+                    report(c, orders[j], length, times, packed, failed,
+                        ru.ru_maxrss, first);
+                    if (write(fds[1], &failed, sizeof(int)) != sizeof(int))
+                        exit(2);
+                    exit(0);
+                }
+                else
+                {   int failed = 1, status;
+                    close(fds[1]);
+                    if (read(fds[0], &failed, sizeof(int)) == sizeof(int))
+                    {   first = 0;  /* the child has written its record */
+                        if (failed)
+                        {   fprintf(stderr, "szbench: %s -o%u -b%u failed\n",
+                                c->name, orders[j], sizes[i]);
+                            errors++;
+                        }
+                    }
+                    else
+                    {   fprintf(stderr, "szbench: %s -o%u -b%u did not finish\n",
+                            c->name, orders[j], sizes[i]);
+                        errors++;
+                    }
+                    close(fds[0]);
+                    waitpid(pid, &status, 0);
+                }
+            }
+    }
+    if (json)
+        printf("\n]}\n");
+    return errors ? 1 : 0;
+}
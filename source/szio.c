@@ -0,0 +1,127 @@
+/*  szio.c      read-ahead and write-behind (szip --async)
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* This file is part of szip.c; comp.c includes it after szip.c. See
+* szio.h. Errors of the threads end szip with the same messages as
+* errors of fread and fwrite; the main thread may be waiting on the
+* pipe then, so they use _exit.
+*/
+
+#include "szio.h"
+#ifdef unix
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#if defined __linux__ && !defined F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031  /* only with _GNU_SOURCE in glibc */
+#endif
+
+typedef struct {
+    int from, to;       /* the thread copies from fd from to fd to */
+    char *error;        /* message if that fails */
+    pthread_t thread;
+} szpump;
+
+static szpump inpump, outpump;
+static pid_t asyncpid;  /* forked jobs do not own the threads */
+
+static void *pumpthread(void *arg)
+{   szpump *p = (szpump*) arg;
+    unsigned char *buf = (unsigned char*) malloc(SZ_ASYNCCHUNK);
+    ssize_t n, w, done;
+    if (buf == NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        _exit(1);
+    }
+    while ((n = read(p->from, buf, SZ_ASYNCCHUNK)) != 0)
+    {   if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {   fprintf(stderr, "%s", p->error);
+            _exit(1);
+        }
+        for (done=0; done<n; done+=w)
+        {   w = write(p->to, buf+done, n-done);
+            if (w < 0 && errno == EINTR)
+                w = 0;
+            else if (w < 0)
+            {   fprintf(stderr, "%s", p->error);
+                _exit(1);
+            }
+        }
+    }
+    close(p->to);
+    free(buf);
+    return NULL;
+}
+
+/* fd (0 or 1) becomes the end of a pipe; the thread gets the other */
+/* end and a copy of what fd was                                    */
+static void startpump(szpump *p, int fd, char *error)
+{   int pfd[2], real = dup(fd);
+    if (real < 0 || pipe(pfd) != 0)
+    {   perror("szip");
+        exit(1);
+    }
+#ifdef F_SETPIPE_SZ
+    fcntl(pfd[1], F_SETPIPE_SZ, SZ_ASYNCCHUNK);  /* as far as allowed */
+#endif
+    p->error = error;
+    p->from = fd ? pfd[0] : real;
+    p->to = fd ? real : pfd[1];
+    if (dup2(fd ? pfd[1] : pfd[0], fd) < 0)
+    {   perror("szip");
+        exit(1);
+    }
+    close(fd ? pfd[1] : pfd[0]);
+    if (pthread_create(&p->thread, NULL, pumpthread, p) != 0)
+    {   fprintf(stderr, "cannot start the thread for --async\n");
+        exit(1);
+    }
+}
+
+void sz_asyncin(void)
+{   startpump(&inpump, fileno(stdin), "Error reading input\n");
+}
+
+/* the pipe ends when fd 1 is closed; then the thread writes the rest */
+static void asyncend(void)
+{   if (getpid() != asyncpid)
+        return;
+    fflush(stdout);
+    close(fileno(stdout));
+    pthread_join(outpump.thread, NULL);
+}
+
+void sz_asyncout(void)
+{   fflush(stdout);
+    startpump(&outpump, fileno(stdout), "Error writing output\n");
+    asyncpid = getpid();
+    atexit(asyncend);
+}
+
+#else
+
+void sz_asyncin(void)
+{
+}
+
+void sz_asyncout(void)
+{
+}
+
+#endif
@@ -0,0 +1,39 @@
+/*  szio.h      read-ahead and write-behind (szip --async)
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* A thread per direction copies between the real input or output and
+* a pipe that takes its place as fd 0 or 1, so the stdio calls of szip
+* stay as they are. While a block is sorted and coded the input thread
+* reads the next one and the output thread writes the last one; the
+* pipe and the buffer of the thread (SZ_ASYNCCHUNK each) bound how far
+* they are ahead, a full or empty pipe makes the other side wait.
+* Without threads (not unix) these do nothing.
+*/
+#ifndef SZIO_H
+#define SZIO_H
+
+#define SZ_ASYNCCHUNK 0x100000  /* bytes a thread reads or writes at once */
+#define SZ_ASYNCMEM (4*(uint8)SZ_ASYNCCHUNK)  /* both threads and pipes */
+
+/* stdin is then read ahead by a thread; before the first read */
+void sz_asyncin(void);
+
+/* stdout is then written behind by a thread; before the first write. */
+/* The output is complete when exit returns (it waits for the thread) */
+void sz_asyncout(void);
+
+#endif
@@ -15,7 +15,7 @@
 * limitations under the License.
 */
 
-static char vmayor=1, vminor=12;
+static char vmayor=1, vminor=14;
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,25 +25,69 @@ static char vmayor=1, vminor=12;
 #endif
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+#include <time.h>
+#ifdef unix
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <errno.h>
+#endif
 #include "port.h"
 #include "sz_mod4.h"
 #include "sz_srt.h"
 #include "reorder.h"
+#include "szarc.h"
+#include "szio.h"
+#include "sz_hash.h"
 
 #define BLOCK_SIZE (1 << SIZE_SHIFT)
 
+#ifdef unix
+#define FSEEK fseeko
+#define FTELL ftello
+#else
+#define FSEEK fseek
+#define FTELL ftell
+#endif
+
 static void usage()
 {   fprintf(stderr,"szip %d.%d (c)1997-2000 Michael Schindler, szip@compressconsult.com\n",
         vmayor, vminor);
     fprintf(stderr,"homepage: http://www.compressconsult.com/szip/\n");
     fprintf(stderr,"usage: szip [options] [inputfile [outputfile]]\n");
+    fprintf(stderr,"       szip -a [options] archive files...\n");
+    fprintf(stderr,"       szip -a -d [options] archive [files...]\n");
     fprintf(stderr,"option           meaning              default   range\n");
     fprintf(stderr,"-d               decompress\n");
     fprintf(stderr,"-b<blocksize>    blocksize in 100kB   -b17      1-41\n");
     fprintf(stderr,"-o<order>        order of context     -o6       0, 3-255\n");
+    fprintf(stderr,"-oauto           order 3-12 chosen per block\n");
     fprintf(stderr,"-r<recordsize>   recordsize           -r1       1-127\n");
+    fprintf(stderr,"-rauto           recordsize 1-16 and -i chosen per block\n");
     fprintf(stderr,"-i               incremental          -i\n");
+    fprintf(stderr,"-s               seekable: write a block index\n");
+    fprintf(stderr,"-c               cut blocks by content, hashes in the index (implies -s)\n");
+    fprintf(stderr,"-p<ms>           progressive blocks, cut after ms  -p50  0-60000\n");
+    fprintf(stderr,"-x<off>[,<len>]  extract len bytes at offset off (implies -d)\n");
+    fprintf(stderr,"-l               list the blocks of a compressed file\n");
+    fprintf(stderr,"-t<jobs>         test a compressed file  -t0       0-255\n");
+    fprintf(stderr,"-a               archive of files and directories\n");
+    fprintf(stderr,"-j<jobs>         jobs for -a          -j0       0-255\n");
     fprintf(stderr,"-v<level>        verbositylevel       -v0       0-255\n");
+    fprintf(stderr,"-m<MB>           memory limit: fewer jobs, smaller blocks  -m0 (none)\n");
+    fprintf(stderr,"-n<step>         estimate: code every step-th block, no output  -n1\n");
+    fprintf(stderr,"--stats=json     one JSON record per block on stderr\n");
+    fprintf(stderr,"--target-rate=<MB/s>  choose stored or -o4 to -o12 per block\n");
+    fprintf(stderr,"--profile=<file> start the model of each block from a profile\n");
+    fprintf(stderr,"--learn=<file>[,<size>]  learn a profile from blocks of size bytes\n");
+    fprintf(stderr,"--hugepages[=tlb]  sort in 2MB pages (transparent or hugetlbfs)\n");
+    fprintf(stderr,"--async          read ahead and write behind in threads\n");
+    fprintf(stderr,"--reference=<file>  with -c: copy unchanged blocks from an earlier -c file\n");
     fprintf(stderr,"options may be combined into one, like -r3i\n");
     exit(1);
 }
@@ -59,10 +103,183 @@ static int readnum(char **s, int min, int max)
 	return j;
 }
 
+static uint8 readbig(char **s)
+{	uint8 j=0;
+	if (!isdigit(**s))
+		usage();
+	while (isdigit(**s))
+	{	j=10*j+**s-'0';
+		*s += 1;
+	}
+	return j;
+}
+
 /* parameter values */
 uint4 blocksize=1703936;
-uint order=6, verbosity=0, compress=1;
+uint order=6, verbosity=0, compress=1, statsjson=0, seekable=0, extract=0;
+uint list=0, test=0, jobs=0, archive=0, autoorder=0, autorecord=0;
+uint progressive=0, stall=0;
+uint estimate=0;  /* -n: every estimate-th block is coded without output */
 unsigned char recordsize=1;
+uint8 xoffset=0, xlength=0;
+double targetrate=0;  /* bytes per second for --target-rate, 0 if off */
+sz_profile *profile=NULL;    /* --profile */
+sz_learning *learning=NULL;  /* --learn: blocks are only coded to learn from */
+sz_workspace work;           /* buffers kept from block to block */
+uint8 memlimit=0;            /* -m in bytes, 0 if none */
+uint asyncio=0;              /* --async */
+uint cdc=0;                  /* -c: blocks cut by content, hashes in the index */
+
+
+/* -m: what the large buffers of a job need. MEMBASE is for the program,  */
+/* the model, stdio and the small tables; with huge pages the few buffers */
+/* above SZ_HUGEMIN are rounded up to whole 2MB pages                     */
+#define MEMBASE 0x400000
+#define MEMHUGE (4*(uint8)0x200000)
+
+/* bytes to compress blocks of n bytes with the options given: the block, */
+/* its copy and the coded block, tmp to reorder and the sorter            */
+static uint8 compressmem(uint4 n)
+{   uint8 sort = sz_workneed(n, order, 1), need;
+    if (autoorder || targetrate > 0)
+    {   /* -o4 sorts flat, the other orders with pointer blocks */
+        if (sz_workneed(n, 4, 1) > sort)
+            sort = sz_workneed(n, 4, 1);
+        if (sz_workneed(n, 12, 1) > sort)
+            sort = sz_workneed(n, 12, 1);
+    }
+    need = MEMBASE + sort + 3*(uint8)n + order + 1;
+    if ((recordsize&0x7f) != 1 || autorecord)
+        need += n + order;
+    if (asyncio)
+        need += SZ_ASYNCMEM;
+    if (cdc)
+        need += n;   /* the input after the cut */
+    return work.huge ? need + MEMHUGE : need;
+}
+
+/* bytes to decode a block of n bytes with order o; withtmp if it is */
+/* unsorted to tmp (not straight to stdout)                           */
+static uint8 decodemem(uint4 n, uint o, int withtmp)
+{   uint8 need = MEMBASE + sz_workneed(n, o, 0) + n + 1;
+    if (withtmp)
+        need += n + 1;
+    if (asyncio)
+        need += SZ_ASYNCMEM;
+    return work.huge ? need + MEMHUGE : need;
+}
+
+static void overlimit(char *what, uint8 need)
+{   fprintf(stderr, "%s needs %lu MB, more than -m%lu\n", what,
+        (unsigned long)((need+0xfffff)>>20), (unsigned long)(memlimit>>20));
+    exit(1);
+}
+
+/* fit compression into -m: first fewer jobs (*njobs, at least 1), then */
+/* smaller blocks; coded if each job also keeps a coded block           */
+static void fitcompress(uint *njobs, int coded)
+{   uint8 need;
+    uint4 n = blocksize;
+    int b;
+    if (memlimit == 0)
+        return;
+    need = compressmem(n) + (coded ? n : 0);
+    if (*njobs > memlimit/need)
+        *njobs = memlimit/need > 0 ? (uint)(memlimit/need) : 1;
+    for (b=blocksize/100000; b>0 && need>memlimit; b--)
+    {   n = (100000*b+0x7fff) & 0x7fff8000L;
+        need = compressmem(n) + (coded ? n : 0);
+    }
+    if (need > memlimit)
+        overlimit("compressing with -b1", need);
+    if (verbosity && (n != blocksize || *njobs > 1))
+        fprintf(stderr, "-m%lu: blocks of %lu bytes, %u job%s\n",
+            (unsigned long)(memlimit>>20), (unsigned long)n, *njobs, *njobs > 1 ? "s" : "");
+    blocksize = n;
+}
+
+
+/* per block statistics for --stats=json; the time between two calls */
+/* of statphase is charged to the phase given in the first call     */
+#define PH_SORT 0   /* (un)reorder, (un)delta and (un)sort */
+#define PH_MODEL 1  /* modelling and coding */
+#define PH_IO 2     /* reading and writing uncoded data (sz_unsrt writes */
+                    /* its output itself, that is counted as PH_SORT) */
+
+static struct {
+    uint4 nr;          /* number of the current block */
+    int phase;         /* current phase or -1 */
+    double wall, cpu;  /* start of the current phase */
+    double walls[3], cpus[3];
+} bstat = {0, -1};
+
+static double walltime()
+{
+#ifdef unix
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + 1e-6*t.tv_usec;
+#else
+    return (double)time(NULL);
+#endif
+}
+
+/* cpu time of the calling thread, so --async IO threads are not counted */
+static double cputime()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec t;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) == 0)
+        return t.tv_sec + 1e-9*t.tv_nsec;
+#endif
+    return (double)clock()/CLOCKS_PER_SEC;
+}
+
+static void statphase(int phase)
+{   double wall, cpu;
+    if (!statsjson) return;
+    wall = walltime();
+    cpu = cputime();
+    if (bstat.phase >= 0)
+    {   bstat.walls[bstat.phase] += wall - bstat.wall;
+        bstat.cpus[bstat.phase] += cpu - bstat.cpu;
+    }
+    bstat.phase = phase;
+    bstat.wall = wall;
+    bstat.cpu = cpu;
+}
+
+/* print the record for a block and reset the counters;              */
+/* size is the uncoded, coded the coded size including the headers   */
+static void statblock(int szipblock, uint4 size, uint4 coded)
+{   long peak = 0;
+    int i;
+    if (!statsjson) return;
+    statphase(-1);
+#ifdef unix
+    {   struct rusage r;
+        if (getrusage(RUSAGE_SELF, &r) == 0)
+            peak = r.ru_maxrss;
+    }
+#endif
+    fprintf(stderr, "{\"block\":%lu,\"mode\":\"%s\",\"type\":\"%s\","
+        "\"size\":%lu,\"coded\":%lu,", (unsigned long)bstat.nr,
+        compress ? "compress" : "decompress", szipblock ? "szip" : "stored",
+        (unsigned long)size, (unsigned long)coded);
+    if (szipblock)
+        fprintf(stderr, "\"order\":%d,\"recordsize\":%d,\"incremental\":%s,",
+            order, recordsize&0x7f, recordsize&0x80 ? "true" : "false");
+    else
+        fprintf(stderr, "\"order\":null,\"recordsize\":null,\"incremental\":null,");
+    fprintf(stderr, "\"wall\":{\"sort\":%.6f,\"model\":%.6f,\"io\":%.6f},",
+        bstat.walls[PH_SORT], bstat.walls[PH_MODEL], bstat.walls[PH_IO]);
+    fprintf(stderr, "\"cpu\":{\"sort\":%.6f,\"model\":%.6f,\"io\":%.6f},",
+        bstat.cpus[PH_SORT], bstat.cpus[PH_MODEL], bstat.cpus[PH_IO]);
+    fprintf(stderr, "\"peak_rss_kb\":%ld}\n", peak);
+    for (i=0; i<3; i++)
+        bstat.walls[i] = bstat.cpus[i] = 0;
+    bstat.nr++;
+}
 
 static void writeglobalheader()
 {   /* write magic SZ\012\004 */
@@ -71,7 +288,12 @@ static void writeglobalheader()
     putchar(0x0a);
     putchar(0x04);
     putchar(0x01); /* version mayor of first version using the format */
-    putchar(0x0b); /* version minor of first version using the format */
+    if (cdc)
+        putchar(0x0e); /* 1.14 added hashes to the index */
+    else if (seekable || archive)
+        putchar(0x0d); /* 1.13 added the index and archives */
+    else
+        putchar(0x0b); /* version minor of first version using the format */
 }
 
 
@@ -122,137 +344,348 @@ static uint4 readuint3()
 }
 
 
+static void writeuint4(uint4 x)
+{   putchar((char)((x>>24)&0xff));
+    writeuint3(x);
+}
+
+
+static uint4 readuint4()
+{   uint4 x;
+    x = getchar();
+    return x<<24 | readuint3();
+}
+
+
+/* The index written with -s is appended after the last block:      */
+/* 'I','X', number of blocks (4 bytes), for each block the uncoded  */
+/* and the coded size (3 bytes each; the coded size counts from the */
+/* block directory to the trailing length), the length of the whole */
+/* index (4 bytes) and 'I','X' again, so it can be found from EOF.  */
+/* With -c it is 'H','X' instead and every block has its SHA-256     */
+/* (SZ_HASHSIZE bytes) after the sizes.                              */
+static uint4 *indexsizes=NULL, indexblocks=0, indexalloc=0;
+static unsigned char *indexhashes=NULL;
+
+#define INDEXENTRY(c) ((c) == 0x48 ? 6+SZ_HASHSIZE : 6)  /* bytes per block */
+
+/* hash is NULL without -c */
+static void addindex(uint4 size, uint4 coded, unsigned char *hash)
+{   if (indexblocks == indexalloc)
+    {   indexalloc = indexalloc ? 2*indexalloc : 256;
+        indexsizes = (uint4*) realloc(indexsizes, 2*indexalloc*sizeof(uint4));
+        indexhashes = (unsigned char*) realloc(indexhashes, indexalloc*SZ_HASHSIZE);
+        if (indexsizes==NULL || indexhashes==NULL)
+        {   fprintf(stderr, "memory allocation error\n");
+            exit(1);
+        }
+    }
+    indexsizes[2*indexblocks] = size;
+    indexsizes[2*indexblocks+1] = coded;
+    if (hash)
+        memcpy(indexhashes+indexblocks*SZ_HASHSIZE, hash, SZ_HASHSIZE);
+    indexblocks++;
+}
+
+
+static void writeindex()
+{   uint4 i;
+    int c = cdc ? 0x48 : 0x49;
+    putchar(c);
+    putchar(0x58);
+    writeuint4(indexblocks);
+    for (i=0; i<indexblocks; i++)
+    {   writeuint3(indexsizes[2*i]);
+        writeuint3(indexsizes[2*i+1]);
+        if (cdc && fwrite(indexhashes+i*SZ_HASHSIZE,1,SZ_HASHSIZE,stdout) != SZ_HASHSIZE)
+        {   fprintf(stderr,"Error writing output\n"); exit(1);}
+    }
+    writeuint4(12+INDEXENTRY(c)*indexblocks);
+    putchar(c);
+    putchar(0x58);
+}
+
+
+/* c is the first byte, 'I' or 'H' */
+static void skipindex(int c)
+{   uint4 n, i;
+    if (getchar() != 0x58) no_szip();
+    n = readuint4();
+    for (i=0; i<n*INDEXENTRY(c); i++)
+        getchar();
+    if (readuint4() != 12+INDEXENTRY(c)*n || feof(stdin)) no_szip();
+    if (getchar() != c) no_szip();
+    if (getchar() != 0x58) no_szip();
+}
+
+
+#define GET3(b) ((uint4)(b)[0]<<16 | (uint4)(b)[1]<<8 | (b)[2])
+#define GET4(b) ((uint4)(b)[0]<<24 | GET3((b)+1))
+
+/* read n bytes at position pos of f; 0 if that fails */
+static int readat(FILE *f, uint8 pos, unsigned char *b, uint n)
+{   if (FSEEK(f, pos, SEEK_SET) != 0)
+        return 0;
+    return fread(b, 1, n, f) == n;
+}
+
+
+/* the index ending at end of f: its *n entries of *entry bytes, NULL */
+/* if there is none or it does not cover the whole file (not the case */
+/* for concatenated files)                                            */
+static unsigned char *readindex(FILE *f, uint8 end, uint4 *n, uint *entry)
+{   unsigned char b[6], *sizes;
+    uint4 total, i;
+    uint8 pos;
+    int c;
+    if (end < 18 || !readat(f, end-6, b, 6) || (b[4]!=0x49 && b[4]!=0x48) || b[5]!=0x58)
+        return NULL;
+    c = b[4];
+    *entry = INDEXENTRY(c);
+    total = GET4(b);
+    if (total < 12 || total > end-6 || (total-12) % *entry != 0)
+        return NULL;
+    if (!readat(f, end-total, b, 6) || b[0]!=c || b[1]!=0x58)
+        return NULL;
+    *n = GET4(b+2);
+    if (*n != (total-12) / *entry)
+        return NULL;
+    sizes = (unsigned char*) malloc(*entry * *n + 1);
+    if (sizes==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    if (fread(sizes, 1, *entry * *n, f) != *entry * *n)
+    {   free(sizes);
+        return NULL;
+    }
+    pos = 6;
+    for (i=0; i<*n; i++)
+        pos += GET3(sizes + *entry*i + 3);
+    if (pos != end-total)
+    {   free(sizes);
+        return NULL;
+    }
+    return sizes;
+}
+
+
 static uint writeblockdir(uint4 buflen)
 {   /* write magic */
     putchar(0x42);
     putchar(0x48);
     writeuint3(buflen);
-    putchar(0);   /* FIXME: empty filename to indicate end of dir */
+    putchar(0);   /* empty filename to indicate end of dir */
     return 6;
 }
 
 
 static uint readblockdir(uint4 *buflen)
 {   int ch;
-    ch = getchar();
-    if (ch == EOF) {*buflen = 0; return 0;}
-    if (ch == 0x53)
-    {   ungetc(ch, stdin);
-        readglobalheader();
-        ch=getchar();
+    while (1)
+    {   ch = getchar();
         if (ch == EOF) {*buflen = 0; return 0;}
+        if (ch == 0x53)  /* concatenated file */
+        {   ungetc(ch, stdin);
+            readglobalheader();
+        }
+        else if (ch == 0x49 || ch == 0x48)
+            skipindex(ch);
+        else
+            break;
     }
     if (ch != 0x42) no_szip();
     if (getchar() != 0x48) no_szip();
     *buflen = readuint3();
-    if (getchar() != 0) no_szip();  /* FIXME: read until empty filename */
-    return 6;
+    return 5 + readarcdir();  /* entries up to the empty filename */
 } 
 
 
-static void writestorblock(uint dirsize, uint4 buflen, unsigned char *buffer)
-{   unsigned char *end;
-    if (verbosity&1) fprintf( stderr, "Storing %d bytes ...", buflen);
+static uint4 writestorblock(uint dirsize, uint4 buflen, unsigned char *buffer)
+{   if (verbosity&1) fprintf( stderr, "Storing %d bytes ...", buflen);
+    statphase(PH_IO);
     putchar(0); /* 0 means stored block */
-    end = buffer + buflen;
-    while (buffer<end)
-    {   putchar(*buffer);
-        buffer++;
-    }
+    if (fwrite(buffer,1,buflen,stdout) != buflen)
+    {   fprintf(stderr,"Error writing output\n"); exit(1);}
     writeuint3(dirsize+4+buflen);
+    return dirsize+4+buflen;
+}
+
+
+/* writes decoded data to stdout or to the files of an archive block */
+static void writedata(unsigned char *data, uint4 len)
+{   if (archive && narcentries)
+        arcwrite(data, len);
+    else if (fwrite(data,1,len,stdout) != len)
+    {   fprintf(stderr,"Error writing output\n"); exit(1);}
 }
 
 
-static void readstorblock(uint dirsize, uint4 buflen, unsigned char *buffer)
+/* only bytes from..to-1 of the block are written */
+static uint4 readstorblock(uint dirsize, uint4 buflen, unsigned char *buffer,
+    uint4 from, uint4 to)
 {   if (verbosity&1) fprintf( stderr, "Reading %d bytes ...", buflen);
+    statphase(PH_IO);
     if (fread(buffer,1,buflen,stdin) != buflen)
     {   fprintf(stderr,"Error reading input\n"); exit(1);}
-    if (fwrite(buffer,1,buflen,stdout) != buflen)
-    {   fprintf(stderr,"Error writing output\n"); exit(1);}
+    writedata(buffer+from, to-from);
     if (readuint3() != dirsize+3+buflen) no_szip();
+    return dirsize+3+buflen;
 }
 
    
-static void writeszipblock(uint dirsize, uint4 buflen, unsigned char *buffer)
-{   uint4 indexlast;
+/* the coded data goes to memory first; if the block would not be   */
+/* smaller than a stored one nothing is written, buffer gets the     */
+/* original data back and 0 is returned                              */
+static uint4 writeszipblock(uint dirsize, uint4 buflen, unsigned char *buffer)
+{   uint4 indexlast, coded;
+    unsigned char *save;
 #ifndef MODELGLOBAL
-    sz_model m;
+    static sz_model m;
 #endif
     if (verbosity&1) fprintf( stderr, "Processing %d bytes ...", buflen);
-    putchar(1); /* 1 means szip block */
+    statphase(PH_SORT);
+    save = (unsigned char*) sz_workget(&work, SZW_SAVE, 2*(size_t)buflen);
+    memcpy(save, buffer, buflen);
+    if (autorecord)
+    {   recordsize = guessrecordsize(buffer, buflen);
+        if (verbosity&1) fprintf(stderr, " -r%d%s ...", recordsize&0x7f,
+            recordsize&0x80 ? "i" : "");
+    }
     if ((recordsize&0x7f) != 1)
     {	unsigned char *tmp;
-		tmp = (unsigned char*) malloc(buflen+order);
-		if (tmp==NULL)
-		{	fprintf(stderr, "memory allocation error\n");
-			exit(1);
-		}
+		tmp = (unsigned char*) sz_workget(&work, SZW_TMP, buflen+order);
 		reorder(buffer,tmp,buflen,recordsize&0x7f);
         memcpy(buffer,tmp,buflen);
-		free(tmp);
 	}
 
     if (recordsize &0x80)
-	{	unsigned char tmp = *buffer;
-        uint4 i;
-		for (i=1; i<buflen; i++)
-		{	unsigned char tmp1 = buffer[i];
-			buffer[i] = (0x100 + tmp1 - tmp) & 0xff;
-			tmp = tmp1;
-		}
-	}
+		makedelta(buffer,buflen);
+
+    if (autoorder)
+    {   uint4 breaks[AUTOORDERS];
+        order = sz_bestorder(&work, buffer, buflen, breaks);
+        if (verbosity&2)
+            fprintf(stderr, " run breaks o3 %lu o4 %lu o6 %lu o8 %lu o12 %lu",
+                (unsigned long)breaks[0], (unsigned long)breaks[1], (unsigned long)breaks[2],
+                (unsigned long)breaks[3], (unsigned long)breaks[4]);
+        if (verbosity&1) fprintf(stderr, " -o%d ...", order);
+    }
 
     if (order==4)
-		sz_srt_o4(buffer,buflen,&indexlast);
+		sz_srt_o4(&work,buffer,buflen,&indexlast);
 	else if (order==0)
-		sz_srt_BW(buffer,buflen,&indexlast);
+		sz_srt_BW(&work,buffer,buflen,&indexlast);
 	else
-		sz_srt(buffer,buflen,&indexlast,order);
+		sz_srt(&work,buffer,buflen,&indexlast,order);
 
     if (verbosity&1) fprintf(stderr," coding ...");
+    statphase(PH_MODEL);
 
-    writeuint3(indexlast);
-    putchar((char)(order&0xff));
-
-    initmodel(&m, dirsize+5, &recordsize);
+    rcout = save+buflen;
+    rcoutpos = 0;
+    rcoutsize = buflen;
+    initmodel(&m, dirsize+(profile ? 9 : 5), &recordsize, profile);
     /* FIXME: write recordsize with putchar with planned output */
+    sz_encodeblock(&m, buffer, buflen);
+    if (learning)
+        sz_learnblock(&m, buffer, buflen, learning);
+    coded = deletemodel(&m);
+    rcout = NULL;
+#ifdef SZSTATS
+    if (verbosity&1) sz_printstats(&m, stderr);
+#endif
 
-  { unsigned char *end;
-    end = buffer+buflen;
-    *end = ~*(end-1); /* to make sure we end a run at end */
-   {unsigned char ch, *begin;
-    begin = buffer;
-    ch = *(buffer++);
-    while (*buffer==ch)
-       buffer++;
-    sz_encode(&m, ch, (uint4)(buffer-begin));
-   }
-    fixafterfirst(&m);
-    while (buffer<end)
-    {   unsigned char ch, *begin;
-        begin = buffer;
-        ch = *(buffer++);
-        while (*buffer==ch)
-            buffer++;
-        sz_encode(&m, ch, (uint4)(buffer-begin));
-    }
-  }
-    deletemodel(&m);
-}
-
-
-static void readszipblock(uint dirsize, uint4 buflen, unsigned char *buffer)
+    if (learning)
+        return coded;   /* only the state of the model is wanted */
+    if (coded >= dirsize+4+buflen)
+    {   if (verbosity&1) fprintf(stderr, " not smaller ...");
+        memcpy(buffer, save, buflen);
+        coded = 0;
+    }
+    else if (!estimate)
+    {   statphase(PH_IO);
+        if (profile)
+        {   putchar(2); /* 2 means szip block with profile */
+            writeuint4(profile->id);
+        }
+        else
+            putchar(1); /* 1 means szip block */
+        writeuint3(indexlast);
+        putchar((char)(order&0xff));
+        if (fwrite(save+buflen,1,rcoutpos,stdout) != rcoutpos)
+        {   fprintf(stderr,"Error writing output\n"); exit(1);}
+    }
+    return coded;
+}
+
+/* the pre-check sees the raw bytes only; with -r, -i or -rauto */
+/* the block is left to the sorter and the size comparison      */
+static int looksrandom(unsigned char *buffer, uint4 buflen)
+{   return recordsize == 1 && !autorecord && incompressible(&work, buffer, buflen);
+}
+
+/* write a block; it is stored if *szipblock is 0, if it looks */
+/* incompressible or if szip would not make it smaller; then   */
+/* *szipblock is set to 0                                       */
+static uint4 writeblock(uint dirsize, uint4 buflen, unsigned char *buffer,
+    uint *szipblock)
+{   uint4 coded;
+    if (*szipblock && looksrandom(buffer, buflen))
+    {   if (verbosity&1) fprintf(stderr, "Incompressible, ");
+        *szipblock = 0;
+    }
+    if (*szipblock)
+    {   coded = writeszipblock(dirsize, buflen, buffer);
+        if (coded)
+            return coded;
+        *szipblock = 0;
+    }
+    return writestorblock(dirsize, buflen, buffer);
+}
+
+
+/* the profile a block of type (1 or 2) is coded with; reads its id */
+static sz_profile *blockprofile(int type)
+{   uint4 id;
+    if (type == 1)
+        return NULL;
+    id = readuint4();
+    if (profile == NULL || profile->id != id)
+    {   fprintf(stderr, "block coded with profile %08lx, give it with --profile\n",
+            (unsigned long)id);
+        exit(1);
+    }
+    return profile;
+}
+
+
+/* only bytes from..to-1 of the block are written */
+/* type is the block type, 1 or 2 (with profile)   */
+static uint4 readszipblock(uint dirsize, uint4 buflen, unsigned char *buffer,
+    uint4 from, uint4 to, int type)
 {   unsigned char *tmp;
-    uint4 indexlast, charcount[256], bytesleft;
+    uint4 indexlast, charcount[256], coded;
+    sz_profile *p;
 #ifndef MODELGLOBAL
-    sz_model m;
+    static sz_model m;
 #endif
     if (verbosity&1) fprintf( stderr, "Decoding %d bytes ", buflen);
+    statphase(PH_MODEL);
+    p = blockprofile(type);
+    if (p)
+        dirsize += 4;
     indexlast = readuint3();
     order = getchar();
 
 	memset(charcount, 0, 256*sizeof(uint4));
-    initmodel(&m, -1, &recordsize);
+    initmodel(&m, -1, &recordsize, p);
+    if (memlimit)
+    {   uint8 need = decodemem(buflen, order, (recordsize&0x7f) != 1 || from != 0 ||
+            (archive && narcentries));
+        if (need > memlimit)
+            overlimit("decoding this block", need);
+    }
 
     if (verbosity&1)
     {   if (order != 6)
@@ -264,106 +697,473 @@ static void readszipblock(uint dirsize, uint4 buflen, unsigned char *buffer)
         fprintf( stderr, "...");
     }
 
-    tmp = buffer;
-    bytesleft = buflen;
-    {   uint4 runlength;
-        uint ch;
-        sz_decode(&m, &ch, &runlength);
-        if (runlength>bytesleft)
-        {	fprintf(stderr, "input file corrupt");
-			exit(1);
-		}
-        bytesleft -= runlength;
-        charcount[ch] += runlength;
-        while (runlength)
-        {   *(tmp++) = ch;
-            runlength--;
-        }
-    }
-    fixafterfirst(&m);
-    while (bytesleft)
-    {   uint4 runlength;
-        uint ch;
-        sz_decode(&m, &ch, &runlength);
-        if (runlength>bytesleft)
-        {	fprintf(stderr, "input file corrupt");
-			exit(1);
-		}
-        bytesleft -= runlength;
-        charcount[ch] += runlength;
-        while (runlength)
-        {   *(tmp++) = ch;
-            runlength--;
-        }
-    }
-    deletemodel(&m);
+    if (sz_decodeblock(&m, buffer, buflen, charcount))
+    {	fprintf(stderr, "input file corrupt");
+		exit(1);
+	}
+    coded = dirsize + 4 + deletemodel(&m);
+#ifdef SZSTATS
+    if (verbosity&1) sz_printstats(&m, stderr);
+#endif
 
     if (verbosity&1) fprintf( stderr, " processing ...");
+    statphase(PH_SORT);
 
-	if (recordsize == 1)
+	/* unreorder and undodelta are done by the unsorter as it writes */
+	if ((recordsize&0x7f) == 1 && from == 0 && !(archive && narcentries))
 	{	if (order==0)
-			sz_unsrt_BW(buffer, NULL, buflen, indexlast, charcount);
+			sz_unsrt_BW(&work, buffer, NULL, buflen, indexlast, charcount, to, recordsize);
 		else
-			sz_unsrt(buffer, NULL, buflen, indexlast, charcount, order);
-//fwrite(buffer,1,buflen,stdout);
+			sz_unsrt(&work, buffer, NULL, buflen, indexlast, charcount, order, to,
+				recordsize);
     }
 	else
-	{	tmp = (unsigned char*) malloc(buflen);
-		if (tmp==NULL)
-		{	fprintf(stderr, "memory allocation failure");
-			exit(1);
-		}
+	{	/* with -r the first to bytes are anywhere in the sorted ones */
+		uint4 len = (recordsize&0x7f) == 1 ? to : buflen;
+		tmp = (unsigned char*) sz_workget(&work, SZW_TMP, buflen);
 		if (order==0)
-			sz_unsrt_BW(buffer, tmp, buflen, indexlast, charcount);
+			sz_unsrt_BW(&work, buffer, tmp, buflen, indexlast, charcount, len, recordsize);
 		else
-			sz_unsrt(buffer, tmp, buflen, indexlast, charcount, order);
-		if (recordsize & 0x80)
-		{	uint4 i;
-            unsigned char c = *tmp;
-			for (i=1; i<buflen; i++)
-			{	c = (c+tmp[i])&0xff;
-				tmp[i] = c;
-			}
-		}
-		unreorder(tmp,buffer,buflen,recordsize&0x7f);
-		free(tmp);
+			sz_unsrt(&work, buffer, tmp, buflen, indexlast, charcount, order, len,
+				recordsize);
+        statphase(PH_IO);
+        writedata(tmp+from, to-from);
+    }
+    return coded;
+}
 
-        bytesleft = fwrite(buffer,1,buflen,stdout);
-        if (bytesleft != buflen)
-		{	fprintf(stderr, "error writing output");
-			exit(1);
-		}
+
+/* --target-rate: the levels the controller moves between, cheapest */
+/* first; level 0 stores the block, the others give the order       */
+#define RATELEVELS 5
+static const uint rateorders[RATELEVELS] = {0, 4, 6, 8, 12};
+#define RATEBEHIND 0x8000  /* bytes waiting in a pipe that mean we are behind */
+#define RATEWAIT 0.1       /* part of the budget a wait must be to count */
+
+static struct {
+    int level;                 /* level for the next block */
+    int pipe;                  /* stdin is a pipe or socket */
+    double cost[RATELEVELS];   /* seconds per byte seen at each level, 0 if unknown */
+} rate;
+
+static void ratestart()
+{   int i;
+    rate.level = 2;
+    for (i=1; i<RATELEVELS; i++)
+        if (rateorders[i] == order)
+            rate.level = i;
+    for (i=0; i<RATELEVELS; i++)
+        rate.cost[i] = 0;
+    rate.pipe = 0;
+#ifdef unix
+    {   struct stat st;
+        if (fstat(fileno(stdin), &st) == 0)
+            rate.pipe = S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode);
+    }
+#endif
+}
+
+/* bytes the producer has written to the input pipe that we did not read yet */
+static uint4 ratebacklog()
+{
+#if defined unix && defined FIONREAD
+    int n;
+    if (rate.pipe && ioctl(fileno(stdin), FIONREAD, &n) == 0 && n > 0)
+        return n;
+#endif
+    return 0;
+}
+
+/* choose the level for the next block after a block of buflen bytes  */
+/* took busy seconds to code and wait seconds to read. The budget is  */
+/* the time the target rate allows; if the producer of a pipe is      */
+/* slower than that (we waited for it and it left nothing behind) we  */
+/* may use the time we waited as well. A full pipe means we are       */
+/* behind, so then the budget is never extended.                      */
+/* A level is left when it misses the budget; the next one is tried   */
+/* when its measured cost fits and the pipe did not fill up without   */
+/* us waiting for it (then the producer is ahead). Costs of unused    */
+/* levels fade so that they are measured again when the data changes. */
+static void ratecontrol(uint4 buflen, double busy, double wait)
+{   double budget, cost, next;
+    uint4 backlog;
+    int i;
+
+    if (buflen == 0) return;
+    cost = busy/buflen;
+    i = rate.level;
+    rate.cost[i] = rate.cost[i] ? 0.5*(rate.cost[i]+cost) : cost;
+    budget = buflen/targetrate;
+    backlog = ratebacklog();
+    if (rate.pipe && backlog == 0 && wait > RATEWAIT*budget && busy+wait > budget)
+        budget = busy+wait;
+    if (busy > budget)
+    {   if (i > 0) rate.level--;
     }
+    else if (i < RATELEVELS-1 && !(backlog >= RATEBEHIND && wait < busy))
+    {   next = rate.cost[i+1] ? rate.cost[i+1] : 2*rate.cost[i];
+        if (next*buflen < 0.9*budget)
+            rate.level++;
+    }
+    for (i=rate.level+1; i<RATELEVELS; i++)
+        rate.cost[i] *= 0.9;
+    if (verbosity&2)
+    {   fprintf(stderr, " %.1f MB/s backlog %lu next ", buflen/busy/1e6,
+            (unsigned long)backlog);
+        if (rate.level) fprintf(stderr, "-o%d", rateorders[rate.level]);
+        else fprintf(stderr, "stored");
+    }
+}
+
+/* -c: blocks end where the rolling hash of the content says, between */
+/* half the blocksize and the blocksize (about 2/3 of it on average),  */
+/* so that an insertion or deletion changes only the blocks around it. */
+/* The input after the end waits in cdcbuf for the next block.         */
+static unsigned char *cdcbuf=NULL;
+static uint4 cdclen=0;
+
+static uint4 readcdcblock(unsigned char *buffer)
+{   uint4 len;
+    uint bits = 0;
+    while ((blocksize/4) >> (bits+1))
+        bits++;
+    cdclen += fread(cdcbuf+cdclen, 1, blocksize-cdclen, stdin);
+    len = sz_cutblock(cdcbuf, cdclen, blocksize/2, bits);
+    memcpy(buffer, cdcbuf, len);
+    memmove(cdcbuf, cdcbuf+len, cdclen-len);
+    cdclen -= len;
+    return len;
 }
 
 
+/* --reference: the blocks of an earlier szip -c file by their hash; */
+/* a block with the same content is copied from there as it is coded */
+typedef struct {
+    unsigned char hash[SZ_HASHSIZE];
+    uint8 pos;      /* of the block directory in reffile */
+    uint4 size, coded;
+} refblock;
+
+static refblock *refblocks=NULL;
+static uint4 nrefblocks=0;
+static FILE *reffile=NULL;
+
+static int refcmp(const void *a, const void *b)
+{   return memcmp(((const refblock*)a)->hash, ((const refblock*)b)->hash, SZ_HASHSIZE);
+}
+
+static void readreference(char *name)
+{   unsigned char *entries;
+    uint4 i;
+    uint entry;
+    uint8 pos = 6;
+    reffile = fopen(name, "rb");
+    if (reffile == NULL)
+    {   perror(name);
+        exit(1);
+    }
+    if (FSEEK(reffile, 0, SEEK_END) != 0 ||
+        (entries = readindex(reffile, FTELL(reffile), &nrefblocks, &entry)) == NULL ||
+        entry != INDEXENTRY(0x48))
+    {   fprintf(stderr, "%s was not written by szip -c\n", name);
+        exit(1);
+    }
+    refblocks = (refblock*) malloc(nrefblocks*sizeof(refblock)+1);
+    if (refblocks==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    for (i=0; i<nrefblocks; i++)
+    {   unsigned char *e = entries + entry*i;
+        refblocks[i].size = GET3(e);
+        refblocks[i].coded = GET3(e+3);
+        refblocks[i].pos = pos;
+        memcpy(refblocks[i].hash, e+6, SZ_HASHSIZE);
+        pos += refblocks[i].coded;
+    }
+    free(entries);
+    qsort(refblocks, nrefblocks, sizeof(refblock), refcmp);
+}
+
+/* writes the block of the reference with this hash if there is one; */
+/* returns its coded size or 0. *szipblock is 0 if it is stored      */
+static uint4 writerefblock(unsigned char *hash, uint4 buflen, uint *szipblock)
+{   refblock key, *r;
+    unsigned char *coded;
+    memcpy(key.hash, hash, SZ_HASHSIZE);
+    r = (refblock*) bsearch(&key, refblocks, nrefblocks, sizeof(refblock), refcmp);
+    if (r == NULL || r->size != buflen || r->coded < 10)
+        return 0;
+    statphase(PH_IO);
+    coded = (unsigned char*) sz_workget(&work, SZW_SAVE, r->coded);
+    if (!readat(reffile, r->pos, coded, r->coded) || coded[0]!=0x42 || coded[1]!=0x48 ||
+        GET3(coded+2) != buflen || coded[5] != 0 || GET3(coded+r->coded-3) != r->coded)
+    {   fprintf(stderr, "the reference file is corrupt\n");
+        exit(1);
+    }
+    /* a block with another profile could not be decoded with ours */
+    if (coded[6] == 2 && (profile == NULL || GET4(coded+7) != profile->id))
+        return 0;
+    if (verbosity&1) fprintf(stderr, "Reusing %d bytes ...", buflen);
+    if (fwrite(coded,1,r->coded,stdout) != r->coded)
+    {   fprintf(stderr,"Error writing output\n"); exit(1);}
+    *szipblock = coded[6] != 0;
+    return r->coded;
+}
+
+
+#define PROGSTART 0x8000   /* first blocksize of -p */
+#define PROGSTALL 50       /* default ms of -p */
+
+/* read the next block; with -p the blocks start at PROGSTART bytes */
+/* and double up to blocksize as long as the input keeps coming. A  */
+/* block is cut when no input arrives for stall ms; then the next   */
+/* one starts small again.                                          */
+static uint4 readblock(unsigned char *buffer)
+{   static uint4 size=0;
+    uint4 len=0;
+    if (cdc)
+        return readcdcblock(buffer);
+    if (!progressive)
+        return fread( (char *)buffer, 1, (size_t)blocksize, stdin);
+    if (size == 0)
+        size = PROGSTART < blocksize ? PROGSTART : blocksize;
+#ifdef unix
+    while (len < size)
+    {   struct pollfd p;
+        int r;
+        p.fd = fileno(stdin);
+        p.events = POLLIN;
+        r = poll(&p, 1, len ? (int)stall : -1);
+        if (r == 0)
+            break;   /* stalled */
+        if (r > 0)
+            r = read(fileno(stdin), buffer+len, size-len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+        {   fprintf(stderr,"Error reading input\n"); exit(1);}
+        if (r == 0)
+            break;   /* end of input */
+        len += r;
+    }
+#else
+    len = fread( (char *)buffer, 1, (size_t)size, stdin);
+#endif
+    if (len == size)
+        size = 2*size < blocksize ? 2*size : blocksize;
+    else
+        size = PROGSTART < blocksize ? PROGSTART : blocksize;
+    return len;
+}
+
 static void compressit()
 {   unsigned char *inoutbuffer;
+    uint extra = order;
 
-    inoutbuffer = (unsigned char*) malloc(blocksize+order+1);
-	if (inoutbuffer==NULL)
-	{	fprintf(stderr, "memory allocation error\n");
-		exit(1);
-	}
+    if (targetrate > 0)
+    {   ratestart();
+        autoorder = 0;
+        if (extra < rateorders[RATELEVELS-1])
+            extra = rateorders[RATELEVELS-1];
+    }
+    {   uint one = 1;
+        fitcompress(&one, 0);
+    }
+    inoutbuffer = (unsigned char*) malloc(blocksize+extra+1);
+    if (cdc)
+        cdcbuf = (unsigned char*) malloc(blocksize);
+    if (inoutbuffer==NULL || (cdc && cdcbuf==NULL) ||
+        sz_workreserve(&work, blocksize, order, 1))
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
 
     writeglobalheader();
 
     while (1)
-    {   uint4 buflen;
-        uint i;
-        buflen = fread( (char *)inoutbuffer, 1, (size_t)blocksize, stdin);
+    {   uint4 buflen, coded;
+        uint i, szipblock;
+        double start=0, readdone=0;
+        unsigned char hash[SZ_HASHSIZE];
+        statphase(PH_IO);
+        if (targetrate > 0)
+            start = walltime();
+        buflen = readblock(inoutbuffer);
         if (buflen == 0) break;
+        if (targetrate > 0)
+        {   readdone = walltime();
+            order = rateorders[rate.level];
+        }
 
-        i = writeblockdir(buflen);
-
-        if (buflen<=order || buflen<=5)
-            writestorblock(i, buflen, inoutbuffer);
-        else
-            writeszipblock(i, buflen, inoutbuffer);
+        if (cdc)
+            sz_sha256(inoutbuffer, buflen, hash);
+        if (!reffile || (coded = writerefblock(hash, buflen, &szipblock)) == 0)
+        {   i = writeblockdir(buflen);
+            szipblock = buflen>order && buflen>5;
+            if (targetrate > 0 && rate.level == 0)
+                szipblock = 0;
+            coded = writeblock(i, buflen, inoutbuffer, &szipblock);
+        }
+        statblock(szipblock, buflen, coded);
+        if (seekable)
+            addindex(buflen, coded, cdc ? hash : NULL);
+        if (targetrate > 0)
+            ratecontrol(buflen, walltime()-readdone, readdone-start);
+        if (progressive)
+            fflush(stdout);
 
 		if (verbosity&1) fprintf(stderr," done\n");
 	}
+    if (seekable)
+        writeindex();
     free(inoutbuffer);
+    free(cdcbuf);
+}
+
+
+/* --learn: code blocks of size bytes of the input only to learn from */
+/* the state they leave the model in; write the profile to file        */
+static void learnit(char *file, uint4 size)
+{   static sz_learning l;
+    sz_profile p;
+    unsigned char *buffer, data[SZ_PROFILESIZE];
+    uint4 buflen, blocks=0;
+    FILE *f;
+
+    buffer = (unsigned char*) malloc(size+order+1);
+    if (buffer==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    learning = &l;
+    profile = NULL;
+    while ((buflen = fread(buffer, 1, size, stdin)) > 0)
+    {   if (buflen <= order || buflen <= 5 || looksrandom(buffer, buflen))
+            continue;
+        writeszipblock(0, buflen, buffer);
+        blocks++;
+        if (verbosity&1) fprintf(stderr," done\n");
+    }
+    if (blocks == 0)
+    {   fprintf(stderr, "no block to learn from\n");
+        exit(1);
+    }
+    sz_makeprofile(&l, &p);
+    sz_saveprofile(&p, data);
+    f = fopen(file, "wb");
+    if (f == NULL || fwrite(data, 1, SZ_PROFILESIZE, f) != SZ_PROFILESIZE ||
+        fclose(f) != 0)
+    {   perror(file);
+        exit(1);
+    }
+    if (verbosity)
+        fprintf(stderr, "profile %08lx learned from %lu blocks\n",
+            (unsigned long)p.id, (unsigned long)blocks);
+    free(buffer);
+}
+
+
+/* -n: the size every step-th block would be coded to, without writing */
+/* it. A JSON line per coded block and a summary go to stdout; if not   */
+/* all blocks are coded the ratio of the coded ones is taken for all,   */
+/* with a 95% confidence interval. Blocks are cut as szip cuts them     */
+/* (without -p); from a file the others are skipped unread.             */
+static void estimateit(uint step)
+{   unsigned char *buffer;
+    uint4 buflen, coded;
+    uint8 nr, blocks=0, total=0, size=0, sum=0;
+    double n=0, ss=0, cc=0, cs=0, ratio, half=0;
+    int seekable = FSEEK(stdin, 0, SEEK_END) == 0;
+    uint one = 1;
+
+    fitcompress(&one, 0);
+    if (seekable)
+    {   total = FTELL(stdin);
+        blocks = (total+blocksize-1)/blocksize;
+    }
+    buffer = (unsigned char*) malloc(blocksize+order+1);
+    if (buffer==NULL || sz_workreserve(&work, blocksize, order, 1))
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    for (nr=0; !seekable || nr<blocks; nr++)
+    {   uint szipblock;
+        if (seekable)
+        {   if (nr % step)
+                continue;
+            if (FSEEK(stdin, nr*blocksize, SEEK_SET) != 0)
+            {   perror("szip");
+                exit(1);
+            }
+        }
+        buflen = fread(buffer, 1, blocksize, stdin);
+        if (buflen == 0)
+            break;
+        if (!seekable)
+            total += buflen;
+        if (nr % step)
+            continue;
+        szipblock = buflen>order && buflen>5 && !looksrandom(buffer, buflen);
+        coded = szipblock ? writeszipblock(6, buflen, buffer) : 0;
+        if (coded == 0)
+        {   szipblock = 0;
+            coded = 6+4+buflen;
+        }
+        printf("{\"block\":%lu,\"type\":\"%s\",\"size\":%lu,\"coded\":%lu,",
+            (unsigned long)nr, szipblock ? "szip" : "stored", (unsigned long)buflen,
+            (unsigned long)coded);
+        if (szipblock)
+            printf("\"order\":%d,\"recordsize\":%d,\"incremental\":%s}\n",
+                order, recordsize&0x7f, recordsize&0x80 ? "true" : "false");
+        else
+            printf("\"order\":null,\"recordsize\":null,\"incremental\":null}\n");
+        if (verbosity&1) fprintf(stderr," done\n");
+        n++;
+        size += buflen;
+        sum += coded;
+        cc += (double)coded*coded;
+        cs += (double)coded*buflen;
+        ss += (double)buflen*buflen;
+    }
+    if (!seekable)
+        blocks = nr;
+    ratio = size ? (double)sum/size : 1;
+    if (n > 1 && n < blocks)
+    {   /* ratio estimator: the residuals coded-ratio*size of the blocks, */
+        /* with the finite population correction                          */
+        double res = cc - 2*ratio*cs + ratio*ratio*ss;
+        half = 1.96 * sqrt((1-n/blocks) / n * (res > 0 ? res : 0) / (n-1)) / (size/n);
+    }
+    printf("{\"blocks\":%lu,\"coded_blocks\":%.0f,\"size\":%lu,\"coded\":%.0f,"
+        "\"ratio\":%.6f,", (unsigned long)blocks, n, (unsigned long)total,
+        6 + (n < blocks ? ratio*total : (double)sum), ratio);
+    /* one sampled block tells nothing about the spread */
+    if (n < 2 && n < blocks)
+        printf("\"ratio_low\":null,\"ratio_high\":null}\n");
+    else
+        printf("\"ratio_low\":%.6f,\"ratio_high\":%.6f}\n", ratio-half, ratio+half);
+    free(buffer);
+}
+
+
+/* --profile */
+static sz_profile *readprofile(char *file)
+{   static sz_profile p;
+    unsigned char data[SZ_PROFILESIZE+1];
+    uint4 n;
+    FILE *f = fopen(file, "rb");
+    if (f == NULL)
+    {   perror(file);
+        exit(1);
+    }
+    n = fread(data, 1, SZ_PROFILESIZE+1, f);
+    fclose(f);
+    if (sz_loadprofile(&p, data, n))
+    {   fprintf(stderr, "%s is no szip profile\n", file);
+        exit(1);
+    }
+    return &p;
 }
 
 
@@ -379,6 +1179,10 @@ static void decompressit()
         int ch;
         dirsize = readblockdir(&blocklen);
         if (dirsize==0) break;
+        if (narcentries && !archive)
+        {   fprintf(stderr, "this is an archive of several files; use szip -a -d\n");
+            exit(1);
+        }
         if (blocklen>blocksize)
         {   if (inoutbuffer != NULL)
                 free(inoutbuffer);
@@ -391,9 +1195,11 @@ static void decompressit()
         }
         ch = getchar();
         if (ch==0)
-            readstorblock(dirsize+1, blocklen, inoutbuffer);
-        else if (ch==1)
-            readszipblock(dirsize+1, blocklen, inoutbuffer);
+            statblock(0, blocklen, readstorblock(dirsize+1, blocklen, inoutbuffer,
+                0, blocklen));
+        else if (ch==1 || ch==2)
+            statblock(1, blocklen, readszipblock(dirsize+1, blocklen, inoutbuffer,
+                0, blocklen, ch));
         else
             no_szip();
 		if (verbosity&1) fprintf(stderr," done\n");
@@ -402,33 +1208,499 @@ static void decompressit()
 }
 
 
+/* position of a block in a seekable archive */
+typedef struct {
+    uint8 pos;      /* file position of the block directory */
+    uint8 start;    /* uncoded position of the first byte of the block */
+    uint4 size;     /* uncoded size */
+    uint4 coded;    /* coded size including directory and length */
+} blockpos;
+
+static blockpos *blocklist=NULL;
+static uint4 nrblocks=0, blocklistalloc=0;
+
+static void addblockpos(uint8 pos, uint4 size, uint4 coded)
+{   if (nrblocks == blocklistalloc)
+    {   blocklistalloc = blocklistalloc ? 2*blocklistalloc : 256;
+        blocklist = (blockpos*) realloc(blocklist, blocklistalloc*sizeof(blockpos));
+        if (blocklist==NULL)
+        {   fprintf(stderr, "memory allocation error\n");
+            exit(1);
+        }
+    }
+    blocklist[nrblocks].pos = pos;
+    blocklist[nrblocks].size = size;
+    blocklist[nrblocks].coded = coded;
+    nrblocks++;
+}
+
+
+/* check for an index ending at end; fills blocklist and returns 1 */
+/* if it covers the whole file (not the case for concatenated files) */
+static int readtrailer(uint8 end)
+{   unsigned char *sizes;
+    uint4 n, i;
+    uint entry;
+    uint8 pos = 6;
+    sizes = readindex(stdin, end, &n, &entry);
+    if (sizes == NULL)
+        return 0;
+    for (i=0; i<n; i++)
+    {   addblockpos(pos, GET3(sizes+entry*i), GET3(sizes+entry*i+3));
+        pos += GET3(sizes+entry*i+3);
+    }
+    free(sizes);
+    return 1;
+}
+
+
+/* find the blocks by walking back from the end using the block   */
+/* length at the end of each block; skips headers and old indices */
+static void scanblocks(uint8 end)
+{   unsigned char b[7];
+    uint8 pos=end;
+    uint4 len, first=nrblocks, i;
+    while (pos > 0)
+    {   if (pos >= 18 && readat(stdin, pos-6, b, 6) && (b[4]==0x49 || b[4]==0x48) &&
+            b[5]==0x58)
+        {   uint entry = INDEXENTRY(b[4]);
+            int c = b[4];
+            len = GET4(b);   /* index of a concatenated file? */
+            if (len >= 12 && len <= pos && (len-12)%entry == 0 &&
+                readat(stdin, pos-len, b, 6) && b[0]==c && b[1]==0x58 &&
+                GET4(b+2) == (len-12)/entry)
+            {   pos -= len;
+                continue;
+            }
+        }
+        if (pos >= 10 && readat(stdin, pos-3, b, 3))
+        {   len = GET3(b);   /* block? */
+            if (len >= 10 && len <= pos && readat(stdin, pos-len, b, 7) &&
+                b[0]==0x42 && b[1]==0x48 && (b[5]!=0 || b[6]<=2))
+            {   pos -= len;
+                addblockpos(pos, GET3(b+2), len);
+                continue;
+            }
+        }
+        if (pos >= 6 && readat(stdin, pos-6, b, 4) &&
+            b[0]==0x53 && b[1]==0x5a && b[2]==0x0a && b[3]==0x04)
+        {   pos -= 6;   /* header */
+            continue;
+        }
+        fprintf(stderr, "cannot find the blocks of the input file\n");
+        exit(1);
+    }
+    for (i=0; i<(nrblocks-first)/2; i++)
+    {   blockpos tmp = blocklist[first+i];
+        blocklist[first+i] = blocklist[nrblocks-1-i];
+        blocklist[nrblocks-1-i] = tmp;
+    }
+}
+
+
+/* fills blocklist for the seekable input file */
+static void findblocks()
+{   uint8 end, start=0;
+    uint4 i;
+    if (FSEEK(stdin, 0, SEEK_END) != 0)
+    {   fprintf(stderr, "input must be a seekable file\n");
+        exit(1);
+    }
+    end = FTELL(stdin);
+    FSEEK(stdin, 0, SEEK_SET);
+    readglobalheader();
+    if (!readtrailer(end))
+        scanblocks(end);
+    for (i=0; i<nrblocks; i++)
+    {   blocklist[i].start = start;
+        start += blocklist[i].size;
+    }
+}
+
+
+/* decode only the blocks containing bytes xoffset..xoffset+xlength-1 */
+static void extractit()
+{   unsigned char *inoutbuffer;
+    uint8 end;
+    uint4 i, maxsize=1;
+
+    findblocks();
+    end = xlength ? xoffset+xlength : ~(uint8)0;
+    for (i=0; i<nrblocks; i++)
+        if (blocklist[i].size > maxsize)
+            maxsize = blocklist[i].size;
+    inoutbuffer = (unsigned char *) malloc(maxsize);
+    if (inoutbuffer==NULL)
+    {	fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+
+    for (i=0; i<nrblocks; i++)
+    {   blockpos *b = blocklist+i;
+        uint4 blocklen, from, to;
+        uint dirsize;
+        int ch;
+        if (b->start+b->size <= xoffset)
+            continue;
+        if (b->start >= end)
+            break;
+        from = xoffset > b->start ? (uint4)(xoffset-b->start) : 0;
+        to = end-b->start < b->size ? (uint4)(end-b->start) : b->size;
+        FSEEK(stdin, b->pos, SEEK_SET);
+        dirsize = readblockdir(&blocklen);
+        ch = getchar();
+        if (ch==0)
+            statblock(0, blocklen, readstorblock(dirsize+1, blocklen, inoutbuffer,
+                from, to));
+        else if (ch==1 || ch==2)
+            statblock(1, blocklen, readszipblock(dirsize+1, blocklen, inoutbuffer,
+                from, to, ch));
+        else
+            no_szip();
+		if (verbosity&1) fprintf(stderr," done\n");
+    }
+    free(inoutbuffer);
+}
+
+
+/* list the blocks; reads only the block headers */
+static void listit()
+{   uint4 i;
+    uint8 coded=0;
+    /* even empty data compresses to a global header */
+    if (FSEEK(stdin, 0, SEEK_END) == 0 && FTELL(stdin) == 0)
+        no_szip();
+    findblocks();
+    printf("block        offset     size    coded  type    order recordsize\n");
+    for (i=0; i<nrblocks; i++)
+    {   blockpos *b = blocklist+i;
+        uint4 blocklen;
+        int type, o, rs;
+        FSEEK(stdin, b->pos, SEEK_SET);
+        readblockdir(&blocklen);
+        type = getchar();
+        printf("%5lu %13llu %8lu %8lu", (unsigned long)i,
+            (unsigned long long)b->start, (unsigned long)b->size,
+            (unsigned long)b->coded);
+        if (type==1 || type==2)
+        {   uint4 id = type==2 ? readuint4() : 0;
+            readuint3();
+            o = getchar();
+            rs = getchar();
+            printf("  szip   %6d %5d%s", o, rs&0x7f, rs&0x80 ? " -i" : "");
+            if (type==2)
+                printf("  profile %08lx", (unsigned long)id);
+            printf("\n");
+        }
+        else
+            printf("  stored\n");
+        coded += b->coded;
+    }
+    if (nrblocks)
+        printf("total %13llu %17llu  %.3f bpc\n",
+            (unsigned long long)(blocklist[nrblocks-1].start+blocklist[nrblocks-1].size),
+            (unsigned long long)coded, blocklist[nrblocks-1].start+blocklist[nrblocks-1].size ?
+            8.0*coded/(blocklist[nrblocks-1].start+blocklist[nrblocks-1].size) : 0.0);
+}
+
+
+/* decode block b with output discarded; returns 0 if it is ok */
+static int testblock(blockpos *b, unsigned char *in, unsigned char *buffer,
+    unsigned char *tmp)
+{   uint4 indexlast, charcount[256];
+    unsigned char rs;
+    uint o, d;
+    sz_profile *p = NULL;
+#ifndef MODELGLOBAL
+    static sz_model m;
+#endif
+    if (b->coded < 10 || in[0]!=0x42 || in[1]!=0x48 || GET3(in+2)!=b->size ||
+        GET3(in+b->coded-3) != b->coded || (d = memdirsize(in, b->coded-3)) == 0)
+        return 1;
+    if (in[d]==0)
+        return b->coded != b->size+d+4;
+    if (in[d]==2 && b->coded >= d+12)
+    {   if (profile == NULL || GET4(in+d+1) != profile->id)
+        {   fprintf(stderr, "block %lu: coded with profile %08lx, give it with --profile\n",
+                (unsigned long)(b-blocklist), (unsigned long)GET4(in+d+1));
+            return 1;
+        }
+        p = profile;
+        d += 4;
+    }
+    else if (in[d]!=1 || b->coded < d+8)
+        return 1;
+    indexlast = GET3(in+d+1);
+    o = in[d+4];
+    if (indexlast >= b->size || o==1 || o==2 || (o && o>b->size))
+        return 1;
+    rcin = in+d+5;
+    rcinend = in+b->coded;
+    memset(charcount, 0, 256*sizeof(uint4));
+    initmodel(&m, -1, &rs, p);
+    if (sz_decodeblock(&m, buffer, b->size, charcount))
+    {   deletemodel(&m);
+        rcin = NULL;
+        return 1;
+    }
+    if (d+5+deletemodel(&m) != b->coded)
+    {   rcin = NULL;
+        return 1;
+    }
+    rcin = NULL;
+    if (o==0)
+        sz_unsrt_BW(&work, buffer, tmp, b->size, indexlast, charcount, b->size, rs);
+    else
+        sz_unsrt(&work, buffer, tmp, b->size, indexlast, charcount, o, b->size, rs);
+    return 0;
+}
+
+
+/* test blocks first, first+step, ...; returns the number of bad ones */
+static uint4 testblocks(uint4 first, uint4 step)
+{   unsigned char *in, *buffer, *tmp;
+    uint4 i, maxsize=1, maxcoded=1, errors=0;
+    for (i=first; i<nrblocks; i+=step)
+    {   if (blocklist[i].size > maxsize)
+            maxsize = blocklist[i].size;
+        if (blocklist[i].coded > maxcoded)
+            maxcoded = blocklist[i].coded;
+    }
+    in = (unsigned char*) malloc(maxcoded);
+    buffer = (unsigned char*) malloc(maxsize+1);
+    tmp = (unsigned char*) malloc(maxsize+1);
+    if (in==NULL || buffer==NULL || tmp==NULL || sz_workreserve(&work, maxsize, 3, 0))
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
+    for (i=first; i<nrblocks; i+=step)
+    {   blockpos *b = blocklist+i;
+#ifdef unix
+        /* pread: the jobs share the file offset */
+        if (pread(fileno(stdin), in, b->coded, b->pos) != (ssize_t)b->coded
+#else
+        if (!readat(stdin, b->pos, in, b->coded)
+#endif
+            || testblock(b, in, buffer, tmp))
+        {   fprintf(stderr, "block %lu at offset %llu is corrupt\n",
+                (unsigned long)i, (unsigned long long)b->pos);
+            errors++;
+        }
+        else if (verbosity&1)
+            fprintf(stderr, "block %lu ok\n", (unsigned long)i);
+    }
+    free(in);
+    free(buffer);
+    free(tmp);
+    return errors;
+}
+
+
+/* decode all blocks in parallel, discarding the output */
+static void testit()
+{   uint4 i, errors=0;
+    if (FSEEK(stdin, 0, SEEK_END) != 0)
+    {   /* a pipe; decode it sequentially */
+#ifdef unix
+        if (freopen("/dev/null", "wb", stdout) == NULL)
+#else
+        if (freopen("NUL", "wb", stdout) == NULL)
+#endif
+        {   fprintf(stderr, "cannot open null device\n");
+            exit(1);
+        }
+        decompressit();
+        return;
+    }
+    findblocks();
+#ifdef unix
+    /* the jobs are processes; a crash on bad data stays in its job */
+    {   uint4 k;
+        int status;
+        if (jobs == 0)
+            jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        if (jobs > nrblocks)
+            jobs = nrblocks;
+        if (jobs < 1)
+            jobs = 1;
+        if (memlimit)
+        {   /* each job keeps its largest coded and decoded block */
+            uint4 maxsize=1, maxcoded=1;
+            uint8 need;
+            for (i=0; i<nrblocks; i++)
+            {   if (blocklist[i].size > maxsize)
+                    maxsize = blocklist[i].size;
+                if (blocklist[i].coded > maxcoded)
+                    maxcoded = blocklist[i].coded;
+            }
+            need = decodemem(maxsize, 3, 1) + maxcoded;
+            if (need > memlimit)
+                overlimit("testing the largest block", need);
+            if (jobs > memlimit/need)
+                jobs = memlimit/need;
+        }
+        fflush(stderr);
+        for (k=0; k<jobs; k++)
+        {   pid_t pid = fork();
+            if (pid == 0)
+            {   i = testblocks(k, jobs);
+                _exit(i > 255 ? 255 : i);
+            }
+            if (pid < 0)
+                errors += testblocks(k, jobs);
+        }
+        while (wait(&status) > 0)
+            if (!WIFEXITED(status))
+            {   fprintf(stderr, "a test job was killed by a corrupt block\n");
+                errors++;
+            }
+            else
+                errors += WEXITSTATUS(status);
+    }
+#else
+    errors = testblocks(0, 1);
+#endif
+    if (errors)
+    {   fprintf(stderr, "%lu of %lu blocks corrupt\n",
+            (unsigned long)errors, (unsigned long)nrblocks);
+        exit(1);
+    }
+    if (verbosity)
+        fprintf(stderr, "%lu blocks ok\n", (unsigned long)nrblocks);
+}
+
 int main( int argc, char *argv[] )
-{	char *infilename=NULL, *outfilename=NULL;
-    uint i;
+{	char *infilename=NULL, *outfilename=NULL, **names, *learnfile=NULL;
+    char *referencefile=NULL;
+    uint i, nnames=0;
+    uint4 learnsize=0;
+
+    names = (char**) malloc(argc*sizeof(char*));
+    if (names==NULL)
+    {   fprintf(stderr, "memory allocation error\n");
+        exit(1);
+    }
 
     for (i=1; i<(unsigned)argc; i++)
 	{	char *s=argv[i];
-	    if (*s == '-')
+	    if (strcmp(s, "--stats=json") == 0)
+	        statsjson = 1;
+	    else if (strncmp(s, "--target-rate=", 14) == 0)
+	    {   targetrate = 1e6*atof(s+14);
+	        if (!(targetrate > 0))
+	            usage();
+	    }
+	    else if (strncmp(s, "--reference=", 12) == 0)
+	        referencefile = s+12;
+	    else if (strcmp(s, "--async") == 0)
+	        asyncio = 1;
+	    else if (strcmp(s, "--hugepages") == 0)
+	        work.huge = SZ_HUGE_THP;
+	    else if (strcmp(s, "--hugepages=tlb") == 0)
+	        work.huge = SZ_HUGE_TLB;
+	    else if (strncmp(s, "--profile=", 10) == 0)
+	        profile = readprofile(s+10);
+	    else if (strncmp(s, "--learn=", 8) == 0)
+	    {   learnfile = s+8;
+	        s = strchr(learnfile, ',');
+	        if (s != NULL)
+	        {   *s++ = 0;
+	            learnsize = atol(s);
+	            if (learnsize < 1 || learnsize > 4120576)
+	                usage();
+	        }
+	    }
+	    else if (*s == '-' && s[1] != 0)
 		{	s++;
 			while (*s)
 				switch (*(s++))
-				{	case 'o': {order = readnum(&s,0,255); 
+				{	case 'o': {if (strncmp(s, "auto", 4) == 0)
+								  {	autoorder = 1;
+									order = 12; /* the largest, for the buffers */
+									s += 4;
+									break;
+								  }
+								  autoorder = 0;
+								  order = readnum(&s,0,255); 
 								  if(order==1 || order==2) usage(); break;}
-					case 'r': {recordsize = (recordsize & 0x80) | 
+					case 'r': {if (strncmp(s, "auto", 4) == 0)
+								  {	autorecord = 1;
+									s += 4;
+									break;
+								  }
+								  autorecord = 0;
+								  recordsize = (recordsize & 0x80) | 
 								  readnum(&s,1,255); break;}
 					case 'b': {blocksize = (100000*readnum(&s,1,41)+0x7fff) & 0x7fff8000L; break;}
 					case 'i': {recordsize |= 0x80; break;}
+					case 's': {seekable = 1; break;}
+					case 'c': {cdc = 1; break;}
+					case 'p': {progressive = 1; stall = PROGSTALL;
+								  if (isdigit(*s)) stall = readnum(&s,0,60000);
+								  break;}
+					case 'a': {archive = 1; break;}
+					case 'j': {jobs = readnum(&s,0,255); break;}
+					case 'l': {list = 1; break;}
+					case 't': {test = 1; jobs = readnum(&s,0,255); break;}
+					case 'x': {xoffset = readbig(&s); xlength = 0;
+								  if (*s == ',') {s++; xlength = readbig(&s);}
+								  extract = 1; compress = 0; break;}
                     case 'v': {verbosity = readnum(&s,0,255); break;}
+                    case 'm': {memlimit = readbig(&s) << 20; break;}
+                    case 'n': {estimate = 1;
+                                  if (isdigit(*s)) estimate = readnum(&s,1,65535);
+                                  break;}
                     case 'd': {compress = 0; break;}
 					default: usage();
 				}
-		} else if (infilename == NULL)
-			infilename = s;
-		else if (outfilename == NULL)
-			outfilename = s;
-		else
+		} else
+			names[nnames++] = s;
+	}
+
+	if (referencefile && !cdc)
+	{	fprintf(stderr, "--reference needs -c\n");
+		exit(1);
+	}
+	if (cdc && progressive)
+	{	fprintf(stderr, "-c and -p cannot be combined: -c cuts the blocks by content\n");
+		exit(1);
+	}
+
+	if (archive)
+	{	if (nnames == 0)
 			usage();
+		asyncio = 0;  /* the jobs of -a and -t have pipes of their own */
+		cdc = 0;      /* -a cuts the blocks by files */
+		if (verbosity) fprintf( stderr, "szip Version %d.%d archive %s\n",
+			vmayor, vminor, names[0]);
+		if (strcmp(names[0], "-") == 0)
+			;   /* stdin or stdout */
+		else if (compress && !list && !test)
+		{	if (freopen( names[0], "wb", stdout ) == NULL)
+			{	perror(names[0]);
+				exit(1);
+			}
+		}
+		else if (freopen( names[0], "rb", stdin ) == NULL)
+		{	perror(names[0]);
+			exit(1);
+		}
+		if (compress && !list && !test)
+			compressarchive(names+1, nnames-1);
+		else if (list)
+			listarchive();
+		else if (test)
+			testit();
+		else
+			extractarchive(names+1, nnames-1);
+		return 0;
 	}
+	if (nnames > 2)
+		usage();
+	if (nnames > 0)
+		infilename = names[0];
+	if (nnames > 1)
+		outfilename = names[1];
 
 	if (verbosity) fprintf( stderr, "szip Version %d.%d on ", vmayor, vminor);
 
@@ -450,7 +1722,34 @@ int main( int argc, char *argv[] )
     setmode( fileno( stdout ), O_BINARY );
 #endif
 
-    if (compress)
+    /* --async for plain compression and decompression; the others seek, */
+    /* and -p and --target-rate watch the input themselves               */
+    if (list || test || extract || learnfile || estimate)
+        asyncio = 0;
+    if (cdc && compress && !learnfile && !estimate)
+    {   seekable = 1;   /* the hashes are in the index */
+        if (referencefile)
+            readreference(referencefile);
+    }
+    else
+        cdc = 0;
+    if (asyncio)
+    {   if (!progressive && targetrate == 0)
+            sz_asyncin();
+        sz_asyncout();
+    }
+
+    if (list)
+        listit();
+    else if (test)
+        testit();
+    else if (extract)
+        extractit();
+    else if (learnfile)
+        learnit(learnfile, learnsize ? learnsize : blocksize);
+    else if (estimate && compress)
+        estimateit(estimate);
+    else if (compress)
         compressit();
     else
         decompressit();
@@ -0,0 +1,690 @@
+/*  szlib.c     streaming interface to szip, see szlib.h
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* Like comp.c this includes the coder, model and sorter, so szlib.o
+* is all a program needs (it cannot be linked together with comp.c).
+*
+* The compressor collects a block and codes it in memory when it is
+* full or flushed, exactly as szip does for its blocks.
+*
+* The range decoder cannot stop in the middle of a block, so the
+* decompressor collects the coded block first. The end of a block is
+* found by its trailing length: every position p where the three bytes
+* before p give p (counted from the block start) is tried. A wrong
+* candidate (one in 2^24 positions) costs a decoding attempt that runs
+* out of input; the real end is never missed. So a block is decoded as
+* soon as its last byte arrived, which is what a sync flush needs.
+*/
+
+/* every stream has its own coder and model, and what the sorter */
+/* keeps between calls is per thread (see port.h)                 */
+#define SZ_THREADS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef unix
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* range coder IO goes to memory; the encoder counts the bytes beyond */
+/* outsize without writing them, the decoder sets inover if it reads  */
+/* beyond inend                                                       */
+#define outbyte(cod,x) ((cod)->outpos<(cod)->outsize ? (cod)->out[(cod)->outpos]=(x) : 0, \
+    (cod)->outpos++)
+#define inbyte(cod)    ((cod)->in<(cod)->inend ? *(cod)->in++ : ((cod)->inover=1, EOF))
+
+uint verbosity=0;   /* used by sz_srt_BW */
+
+#include "rangecod.c"
+#include "qsmodel.c"
+#ifdef VECMODEL
+#include "vecmodel.c"
+#else
+#include "bitmodel.c"
+#endif
+#include "sz_mod4.c"
+#include "sz_srt.c"
+#include "reorder.c"
+#include "szlib.h"
+#include "sz_hash.h"
+
+#define SZDEFAULTBLOCK 1703936  /* as szip -b17 */
+#define SZMAXBLOCK 4120576      /* as szip -b41 */
+#define SZINCHUNK 0x10000       /* input taken at a time while looking for a block end */
+#define HEADERSIZE 6            /* 'B','H', length, empty directory */
+#define SZMAXTHREADS 64         /* threads of szip_compress_batch */
+
+#define GET3(p) ((uint4)(p)[0]<<16 | (uint4)(p)[1]<<8 | (p)[2])
+#define GET4(p) ((uint4)(p)[0]<<24 | GET3((p)+1))
+#define PUT3(p,x) ((p)[0]=(unsigned char)((x)>>16), (p)[1]=(unsigned char)((x)>>8), \
+    (p)[2]=(unsigned char)(x))
+#define PUT4(p,x) ((p)[0]=(unsigned char)((x)>>24), PUT3((p)+1,x))
+
+struct szip_profile {
+    sz_profile p;
+};
+
+struct szip_stream {
+    int compress;
+    uint4 blocksize;        /* compressor only */
+    uint order;
+    unsigned char recordsize;
+    unsigned char *buf;     /* uncoded block */
+    uint4 buflen, bufalloc;
+    unsigned char *save;    /* compressor: copy of the block while it is sorted */
+    unsigned char *in;      /* decompressor: coded bytes not used yet */
+    uint4 inlen, inalloc;
+    uint4 scanned;          /* decompressor: block ends before this are ruled out */
+    int started;            /* decompressor: the global header is checked */
+    unsigned char *out;     /* output not handed out yet */
+    uint4 outpos, outlen, outalloc;
+    sz_model *m;
+    sz_profile *profile;    /* szip_set_profile */
+    sz_workspace work;      /* buffers of the sorter; its alloc and free are */
+                            /* used for all memory of the stream            */
+};
+
+
+/* hand out as much output as fits; 1 if some is left */
+static int drain(szip_stream *s, unsigned char **out, size_t *outcap)
+{   size_t n = s->outlen - s->outpos;
+    if (n > *outcap)
+        n = *outcap;
+    memcpy(*out, s->out + s->outpos, n);
+    *out += n;
+    *outcap -= n;
+    s->outpos += n;
+    if (s->outpos < s->outlen)
+        return 1;
+    s->outpos = s->outlen = 0;
+    return 0;
+}
+
+
+/* make room for n bytes in *p of s, keeping its contents; 1 if out of memory */
+static int grow(szip_stream *s, unsigned char **p, uint4 *alloc, uint4 n)
+{   unsigned char *q;
+    if (n <= *alloc)
+        return 0;
+    q = (unsigned char*) workalloc(&s->work, n);
+    if (q == NULL)
+        return 1;
+    if (*alloc)
+        memcpy(q, *p, *alloc);
+    workrelease(&s->work, *p);
+    *p = q;
+    *alloc = n;
+    return 0;
+}
+
+
+/* a stream of zeros with its model; NULL if out of memory */
+static szip_stream *newstream(sz_allocfunc allocfn, sz_freefunc freefn, void *opaque)
+{   sz_workspace w;
+    szip_stream *s;
+    sz_workinit(&w, allocfn, freefn, opaque);
+    s = (szip_stream*) workalloc(&w, sizeof(szip_stream));
+    if (s == NULL)
+        return NULL;
+    memset(s, 0, sizeof(szip_stream));
+    s->work = w;
+    s->m = (sz_model*) workalloc(&w, sizeof(sz_model));
+    if (s->m == NULL)
+    {   workrelease(&w, s);
+        return NULL;
+    }
+    memset(s->m, 0, sizeof(sz_model));
+    return s;
+}
+
+
+void szip_end(szip_stream *s)
+{   sz_workspace w;
+    if (s == NULL)
+        return;
+    w = s->work;
+    workrelease(&w, s->buf);
+    workrelease(&w, s->save);
+    workrelease(&w, s->in);
+    workrelease(&w, s->out);
+    sz_freemodel(s->m);
+    workrelease(&w, s->m);
+    workrelease(&w, s);
+    sz_workfree(&w);
+}
+
+
+/******************************* compression *******************************/
+
+/* 1 if szip_compress_init does not take order and recordsize */
+static int badparams(int order, int recordsize)
+{   return order < 0 || order == 1 || order == 2 || order > 255 ||
+        (recordsize&0x7f) == 0 || recordsize > 255;
+}
+
+
+/* start a new stream in s: drop what is buffered and queue the header */
+static void compress_reset(szip_stream *s)
+{   s->buflen = 0;
+    s->outpos = 0;
+    /* global header as szip writes it, handed out with the first output */
+    memcpy(s->out, "SZ\n\4\1\13", 6);
+    s->outlen = 6;
+}
+
+
+/* a compressor whose sorter buffers grow with the blocks */
+static szip_stream *compress_new(size_t blocksize, int order, int recordsize,
+    sz_allocfunc allocfn, sz_freefunc freefn, void *opaque)
+{   szip_stream *s;
+    if (blocksize == 0)
+        blocksize = SZDEFAULTBLOCK;
+    if (blocksize > SZMAXBLOCK || badparams(order, recordsize))
+        return NULL;
+    s = newstream(allocfn, freefn, opaque);
+    if (s == NULL)
+        return NULL;
+    s->compress = 1;
+    s->blocksize = (uint4)blocksize;
+    s->order = order;
+    s->recordsize = (unsigned char)recordsize;
+    s->bufalloc = s->blocksize + order + 1;
+    s->outalloc = 6 + HEADERSIZE + 4 + s->blocksize;
+    s->buf = (unsigned char*) workalloc(&s->work, s->bufalloc);
+    s->save = (unsigned char*) workalloc(&s->work, s->blocksize);
+    s->out = (unsigned char*) workalloc(&s->work, s->outalloc);
+    if (s->buf == NULL || s->save == NULL || s->out == NULL)
+    {   szip_end(s);
+        return NULL;
+    }
+    compress_reset(s);
+    return s;
+}
+
+
+szip_stream *szip_compress_init(size_t blocksize, int order, int recordsize)
+{   return szip_compress_init_alloc(blocksize, order, recordsize, NULL, NULL, NULL);
+}
+
+
+szip_stream *szip_compress_init_alloc(size_t blocksize, int order, int recordsize,
+    szip_alloc_func allocfn, szip_free_func freefn, void *opaque)
+{   szip_stream *s;
+    if ((allocfn == NULL) != (freefn == NULL))
+        return NULL;
+    s = compress_new(blocksize, order, recordsize, allocfn, freefn, opaque);
+    if (s != NULL && (sz_workreserve(&s->work, s->blocksize, s->order, 1) ||
+        ((recordsize&0x7f) != 1 && sz_workgrow(&s->work, SZW_TMP, s->blocksize))))
+    {   szip_end(s);
+        return NULL;
+    }
+    return s;
+}
+
+
+/* code the collected block to s->out (which is empty); */
+/* 1 if out of memory                                   */
+static int encodeblock(szip_stream *s)
+{   uint4 n = s->buflen, indexlast, coded;
+    uint4 h = s->profile ? HEADERSIZE+4 : HEADERSIZE;   /* szip block header */
+    unsigned char *o = s->out, first = s->recordsize;
+    int szipblock;
+
+    o[0] = 0x42;
+    o[1] = 0x48;
+    PUT3(o+2, n);
+    o[5] = 0;   /* empty directory */
+    /* after this the sorter does not allocate (which would abort if it fails) */
+    if (sz_workreserve(&s->work, n, s->order, 1) ||
+        ((first&0x7f) != 1 && sz_workgrow(&s->work, SZW_TMP, n)))
+        return 1;
+    szipblock = n > s->order && n > 5 &&
+        (first != 1 || !incompressible(&s->work, s->buf, n));
+    if (szipblock)
+    {   memcpy(s->save, s->buf, n);
+        if ((first&0x7f) != 1)
+        {   unsigned char *tmp = (unsigned char*) sz_workget(&s->work, SZW_TMP, n);
+            reorder(s->buf, tmp, n, first&0x7f);
+            memcpy(s->buf, tmp, n);
+        }
+        if (first & 0x80)
+            makedelta(s->buf, n);
+        if (s->order == 4)
+            sz_srt_o4(&s->work, s->buf, n, &indexlast);
+        else if (s->order == 0)
+            sz_srt_BW(&s->work, s->buf, n, &indexlast);
+        else
+            sz_srt(&s->work, s->buf, n, &indexlast, s->order);
+
+        s->m->ac.out = o + h + 5;
+        s->m->ac.outpos = 0;
+        s->m->ac.outsize = n;
+        initmodel(s->m, h+5, &first, s->profile);
+        sz_encodeblock(s->m, s->buf, n);
+        coded = deletemodel(s->m);
+        if (coded < HEADERSIZE+4+n)
+        {   if (s->profile)
+            {   o[HEADERSIZE] = 2;   /* szip block with profile */
+                PUT4(o+HEADERSIZE+1, s->profile->id);
+            }
+            else
+                o[HEADERSIZE] = 1;
+            PUT3(o+h+1, indexlast);
+            o[h+4] = (unsigned char)s->order;
+            s->outlen = coded;
+        }
+        else
+        {   memcpy(s->buf, s->save, n);   /* would not get smaller */
+            szipblock = 0;
+        }
+    }
+    if (!szipblock)
+    {   o[HEADERSIZE] = 0;
+        memcpy(o+HEADERSIZE+1, s->buf, n);
+        PUT3(o+HEADERSIZE+1+n, HEADERSIZE+4+n);
+        s->outlen = HEADERSIZE+4+n;
+    }
+    s->buflen = 0;
+    return 0;
+}
+
+
+int szip_compress_stream(szip_stream *s, const unsigned char **in, size_t *inlen,
+    unsigned char **out, size_t *outcap, int flush)
+{   size_t n;
+    if (s == NULL || !s->compress || flush < SZIP_NO_FLUSH || flush > SZIP_FINISH)
+        return SZIP_PARAM_ERROR;
+    while (1)
+    {   if (drain(s, out, outcap))
+            return SZIP_OK;
+        if (*inlen)
+        {   n = s->blocksize - s->buflen;
+            if (n > *inlen)
+                n = *inlen;
+            memcpy(s->buf + s->buflen, *in, n);
+            s->buflen += n;
+            *in += n;
+            *inlen -= n;
+            if (s->buflen < s->blocksize)
+                continue;
+        }
+        else if (s->buflen == 0 || flush == SZIP_NO_FLUSH)
+            return flush == SZIP_FINISH ? SZIP_END : SZIP_OK;
+        if (encodeblock(s))
+            return SZIP_MEM_ERROR;
+    }
+}
+
+
+szip_profile *szip_profile_load(const unsigned char *data, size_t len)
+{   szip_profile *p;
+    if (data == NULL || len != SZ_PROFILESIZE)
+        return NULL;
+    p = (szip_profile*) malloc(sizeof(szip_profile));
+    if (p == NULL)
+        return NULL;
+    if (sz_loadprofile(&p->p, (unsigned char*)data, (uint4)len))
+    {   free(p);
+        return NULL;
+    }
+    return p;
+}
+
+
+void szip_profile_free(szip_profile *p)
+{   free(p);
+}
+
+
+int szip_set_profile(szip_stream *s, const szip_profile *p)
+{   if (s == NULL)
+        return SZIP_PARAM_ERROR;
+    s->profile = p ? (sz_profile*)&p->p : NULL;
+    return SZIP_OK;
+}
+
+
+/****************************** decompression ******************************/
+
+szip_stream *szip_decompress_init(void)
+{   return newstream(NULL, NULL, NULL);
+}
+
+
+szip_stream *szip_decompress_init_alloc(szip_alloc_func allocfn, szip_free_func freefn,
+    void *opaque)
+{   if ((allocfn == NULL) != (freefn == NULL))
+        return NULL;
+    return newstream(allocfn, freefn, opaque);
+}
+
+
+/* decode the szip block of n bytes that ends at s->in+end into s->out; */
+/* its header is h bytes (more than HEADERSIZE with a profile id);      */
+/* 1 if it does not end there, -1 if corrupt, -2 if out of memory       */
+static int decodeblock(szip_stream *s, uint4 n, uint4 end, uint4 h)
+{   uint4 indexlast, counts[256];
+    unsigned char first;
+    int err;
+
+    indexlast = GET3(s->in+h+1);
+    s->order = s->in[h+4];
+    if (s->order == 1 || s->order == 2 || indexlast >= n || n < s->order)
+        return -1;
+    if (grow(s, &s->buf, &s->bufalloc, n) || grow(s, &s->out, &s->outalloc, n) ||
+        sz_workreserve(&s->work, n, s->order, 0))
+        return -2;
+    s->m->ac.in = s->in + h + 5;
+    s->m->ac.inend = s->in + end;
+    s->m->ac.inover = 0;
+    memset(counts, 0, 256*sizeof(uint4));
+    initmodel(s->m, -1, &first, h > HEADERSIZE ? s->profile : NULL);
+    err = sz_decodeblock(s->m, s->buf, n, counts);
+    deletemodel(s->m);
+    if (s->m->ac.inover || s->m->ac.in != s->m->ac.inend)
+        return 1;
+    if (err || (first&0x7f) == 0)
+        return -1;
+
+    /* with the records put back and the deltas summed up */
+    if (s->order == 0)
+        sz_unsrt_BW(&s->work, s->buf, s->out, n, indexlast, counts, n, first);
+    else
+        sz_unsrt(&s->work, s->buf, s->out, n, indexlast, counts, s->order, n, first);
+    s->outlen = n;
+    return 0;
+}
+
+
+/* use the item at the start of s->in: a global header, an index or a block */
+/* returns the number of bytes used, 0 if more input is needed (all of it   */
+/* is given if finish), SZIP_DATA_ERROR or SZIP_MEM_ERROR                   */
+static long decodestep(szip_stream *s, int finish)
+{   unsigned char *p = s->in;
+    uint4 len = s->inlen, n, end, h;
+    int r;
+
+    if (len == 0)
+        return 0;
+    if (!s->started && p[0] == 0x42)
+        s->started = 1;   /* blocks without header */
+    if (p[0] == 0x53 || !s->started)
+    {   if (len < 6)
+            return finish ? SZIP_DATA_ERROR : 0;
+        if (memcmp(p, "SZ\n\4", 4) != 0 || p[4] == 0 ||
+            p[4] > 1 || (p[4] == 1 && (p[5] > 14 || p[5] == 10)))
+            return SZIP_DATA_ERROR;
+        s->started = 1;
+        return 6;
+    }
+    if (p[0] == 0x49 || p[0] == 0x48)   /* index of szip -s, with hashes of -c */
+    {   if (len < 6)
+            return finish ? SZIP_DATA_ERROR : 0;
+        n = GET4(p+2);
+        if (p[1] != 0x58 || n > 0x10000000)
+            return SZIP_DATA_ERROR;
+        end = 12 + (p[0] == 0x48 ? 6+SZ_HASHSIZE : 6)*n;
+        if (len < end)
+            return finish ? SZIP_DATA_ERROR : 0;
+        if (GET4(p+end-6) != end || p[end-2] != p[0] || p[end-1] != 0x58)
+            return SZIP_DATA_ERROR;
+        return end;
+    }
+    if (p[0] != 0x42 || (len > 1 && p[1] != 0x48))
+        return SZIP_DATA_ERROR;
+    if (len < HEADERSIZE+1)
+        return finish ? SZIP_DATA_ERROR : 0;
+    if (p[5] != 0)
+        return SZIP_DATA_ERROR;   /* archive entries are not supported */
+    n = GET3(p+2);
+    if (p[HEADERSIZE] == 0)   /* stored */
+    {   end = HEADERSIZE+4+n;
+        if (len < end)
+            return finish ? SZIP_DATA_ERROR : 0;
+        if (GET3(p+end-3) != end)
+            return SZIP_DATA_ERROR;
+        if (grow(s, &s->out, &s->outalloc, n))
+            return SZIP_MEM_ERROR;
+        memcpy(s->out, p+HEADERSIZE+1, n);
+        s->outlen = n;
+        s->scanned = 0;
+        return end;
+    }
+    h = HEADERSIZE;
+    if (p[HEADERSIZE] == 2)   /* with profile */
+    {   if (len < HEADERSIZE+5)
+            return finish ? SZIP_DATA_ERROR : 0;
+        if (s->profile == NULL || GET4(p+HEADERSIZE+1) != s->profile->id)
+            return SZIP_DATA_ERROR;
+        h += 4;
+    }
+    else if (p[HEADERSIZE] != 1)
+        return SZIP_DATA_ERROR;
+    if (s->scanned < h+5+3)
+        s->scanned = h+5+3;
+    for (end=s->scanned; end<=len; end++)
+        if (GET3(p+end-3) == end)
+        {   r = decodeblock(s, n, end, h);
+            if (r < 0)
+                return r == -2 ? SZIP_MEM_ERROR : SZIP_DATA_ERROR;
+            if (r == 0)
+            {   s->scanned = 0;
+                return end;
+            }
+        }
+    s->scanned = end;
+    return finish ? SZIP_DATA_ERROR : 0;
+}
+
+
+int szip_decompress_stream(szip_stream *s, const unsigned char **in, size_t *inlen,
+    unsigned char **out, size_t *outcap, int flush)
+{   long r;
+    size_t n;
+    if (s == NULL || s->compress || flush < SZIP_NO_FLUSH || flush > SZIP_FINISH)
+        return SZIP_PARAM_ERROR;
+    while (1)
+    {   if (drain(s, out, outcap))
+            return SZIP_OK;
+        r = decodestep(s, flush == SZIP_FINISH && *inlen == 0);
+        if (r < 0)
+            return (int)r;
+        if (r > 0)
+        {   memmove(s->in, s->in + r, s->inlen - r);
+            s->inlen -= r;
+            continue;
+        }
+        if (*inlen == 0)
+            return flush == SZIP_FINISH ? SZIP_END : SZIP_OK;
+        n = *inlen < SZINCHUNK ? *inlen : SZINCHUNK;
+        if (grow(s, &s->in, &s->inalloc, s->inlen + n))
+            return SZIP_MEM_ERROR;
+        memcpy(s->in + s->inlen, *in, n);
+        s->inlen += n;
+        *in += n;
+        *inlen -= n;
+    }
+}
+
+
+/********************************** batch **********************************/
+
+size_t szip_bound(size_t len)
+{   return 6 + len + (HEADERSIZE+4) * ((len + SZDEFAULTBLOCK-1) / SZDEFAULTBLOCK);
+}
+
+
+typedef struct {
+    size_t n, next;         /* buffers, the next one not taken yet */
+    const unsigned char *const *in;
+    const size_t *inlen;
+    unsigned char *const *out;
+    const size_t *outcap;
+    size_t *outlen;
+    int order, recordsize;
+    sz_profile *profile;
+    int result;             /* first error */
+    int helpers;            /* pool threads still wanted */
+    int active;             /* threads working on it, the caller included */
+} szbatch;
+
+#ifdef unix
+/* the pool: threads started once and kept for later batches, with the */
+/* batch being coded; batches of several callers take turns            */
+static pthread_mutex_t poollock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pooluser = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pooldone = PTHREAD_COND_INITIALIZER;
+static szbatch *poolbatch;
+static int poolthreads;
+#define LOCK() pthread_mutex_lock(&poollock)
+#define UNLOCK() pthread_mutex_unlock(&poollock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+
+/* code one buffer with s, which is kept by the thread; s is sized */
+/* for every order and gets the parameters of the batch; its       */
+/* sorter buffers grow to the largest buffer the thread codes      */
+static int batchone(szbatch *b, szip_stream **s, size_t i)
+{   const unsigned char *in = b->in[i];
+    size_t inlen = b->inlen[i], outcap = b->outcap[i];
+    unsigned char *out = b->out[i];
+    int r;
+
+    if (*s == NULL && (*s = compress_new(0, 255, 1, NULL, NULL, NULL)) == NULL)
+        return SZIP_MEM_ERROR;
+    (*s)->order = b->order;
+    (*s)->recordsize = (unsigned char)b->recordsize;
+    (*s)->profile = b->profile;
+    compress_reset(*s);
+    r = szip_compress_stream(*s, &in, &inlen, &out, &outcap, SZIP_FINISH);
+    b->outlen[i] = out - b->out[i];
+    if (r == SZIP_END)
+        return SZIP_OK;
+    b->outlen[i] = 0;
+    return r == SZIP_OK ? SZIP_BUF_ERROR : r;   /* OK: output left over */
+}
+
+
+/* take buffers of b until none are left */
+static void batchwork(szbatch *b, szip_stream **s)
+{   size_t i;
+    int r;
+    while (1)
+    {   LOCK();
+        i = b->next;
+        if (i < b->n)
+            b->next++;
+        UNLOCK();
+        if (i >= b->n)
+            return;
+        r = batchone(b, s, i);
+        if (r != SZIP_OK)
+        {   LOCK();
+            if (b->result == SZIP_OK)
+                b->result = r;
+            UNLOCK();
+        }
+    }
+}
+
+
+#ifdef unix
+static void *poolthread(void *arg)
+{   szip_stream *s = NULL;
+    szbatch *b;
+    LOCK();
+    while (1)
+    {   while (poolbatch == NULL || poolbatch->helpers == 0)
+            pthread_cond_wait(&poolwork, &poollock);
+        b = poolbatch;
+        b->helpers--;
+        b->active++;
+        UNLOCK();
+        batchwork(b, &s);
+        LOCK();
+        if (--b->active == 0)
+            pthread_cond_signal(&pooldone);
+    }
+    return arg;
+}
+#endif
+
+
+int szip_compress_batch(size_t n, const unsigned char *const *in, const size_t *inlen,
+    unsigned char *const *out, const size_t *outcap, size_t *outlen,
+    int order, int recordsize, const szip_profile *profile, int threads)
+{   static THREADLOCAL szip_stream *s = NULL;   /* the part of the caller */
+    szbatch b;
+
+    if ((n && (in == NULL || inlen == NULL || out == NULL || outcap == NULL ||
+        outlen == NULL)) || badparams(order, recordsize))
+        return SZIP_PARAM_ERROR;
+    b.n = n;
+    b.next = 0;
+    b.in = in;
+    b.inlen = inlen;
+    b.out = out;
+    b.outcap = outcap;
+    b.outlen = outlen;
+    b.order = order;
+    b.recordsize = recordsize;
+    b.profile = profile ? (sz_profile*)&profile->p : NULL;
+    b.result = SZIP_OK;
+    b.active = 1;
+#ifdef unix
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > SZMAXTHREADS)
+        threads = SZMAXTHREADS;
+    if ((size_t)threads > n)
+        threads = (int)n;
+    b.helpers = threads > 1 ? threads-1 : 0;
+    if (b.helpers)
+    {   pthread_t t;
+        pthread_mutex_lock(&pooluser);
+        LOCK();
+        while (poolthreads < b.helpers &&
+               pthread_create(&t, NULL, poolthread, NULL) == 0)
+        {   pthread_detach(t);
+            poolthreads++;
+        }
+        poolbatch = &b;
+        pthread_cond_broadcast(&poolwork);
+        UNLOCK();
+    }
+    batchwork(&b, &s);
+    if (threads > 1)
+    {   LOCK();
+        b.active--;
+        while (b.active)
+            pthread_cond_wait(&pooldone, &poollock);
+        poolbatch = NULL;
+        UNLOCK();
+        pthread_mutex_unlock(&pooluser);
+    }
+#else
+    (void)threads;
+    batchwork(&b, &s);
+#endif
+    return b.result;
+}
@@ -0,0 +1,139 @@
+/*  szlib.h     streaming interface to szip
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* Compresses and decompresses in the format of szip (without archive
+* entries and without index) within buffers of the caller, in the
+* style of zlib:
+*
+*   s = szip_compress_init(0, 6, 1);
+*   while (more input)
+*   {   in = ...; inlen = ...;
+*       do
+*       {   out = buffer; outcap = sizeof(buffer);
+*           ret = szip_compress_stream(s, &in, &inlen, &out, &outcap, flush);
+*           write out the bytes from buffer to out
+*       } while (inlen || outcap == 0);
+*   }
+*   repeat with SZIP_FINISH until SZIP_END is returned
+*   szip_end(s);
+*
+* Each call consumes input and produces output as far as possible;
+* *in and *out are advanced and *inlen and *outcap reduced by the
+* bytes used. The output of the compressor can be decoded by szip -d
+* and the decompressor reads the output of szip.
+*
+* Memory: a compressor keeps one block of input, a copy of it and the
+* coded block; the decompressor keeps the coded and the decoded block.
+* Sorting and unsorting need about 5 more bytes per byte of the block.
+* All of it stays with the stream from block to block: a compressor
+* takes it for blocksize at init, a decompressor when a larger block
+* comes; after that coding allocates nothing (except when the sorter
+* needs more pointer blocks than before, which it then keeps). The
+* _alloc variants of the init functions take the memory from the
+* callbacks of the caller; the small tables of the model use malloc.
+*
+* Every stream has its own coder, model and buffers, so different
+* streams may be used by different threads at the same time (one
+* stream by one thread at a time).
+*
+* szip_compress_batch codes many independent buffers, each to a
+* complete szip stream of its own, on a pool of threads. The threads
+* and their buffers stay for later batches, so small buffers do not pay
+* for setting them up. On unix link with -lpthread.
+*
+* A profile (written by szip --learn from sample data) gives the model
+* a better start than the built in one, which helps small blocks. The
+* blocks name the profile they were coded with; the decompressor needs
+* the same profile (like szip --profile).
+*/
+#ifndef SZLIB_H
+#define SZLIB_H
+
+#include <stddef.h>
+
+/* flush modes */
+#define SZIP_NO_FLUSH   0  /* blocks are coded when blocksize bytes are in */
+#define SZIP_SYNC_FLUSH 1  /* end the current block: all input so far can be decoded */
+#define SZIP_FINISH     2  /* no more input follows */
+
+/* return values */
+#define SZIP_OK          0  /* progress; call again with more input or output space */
+#define SZIP_END         1  /* SZIP_FINISH given and all output produced */
+#define SZIP_DATA_ERROR (-1) /* input of the decompressor is no szip data or truncated */
+#define SZIP_MEM_ERROR  (-2)
+#define SZIP_PARAM_ERROR (-3)
+#define SZIP_BUF_ERROR  (-4) /* an output buffer of szip_compress_batch is too small */
+
+typedef struct szip_stream szip_stream;
+typedef struct szip_profile szip_profile;
+
+/* memory of a stream: alloc returns size bytes or NULL, free gives back */
+/* what alloc returned; opaque is passed to both                       */
+typedef void *(*szip_alloc_func)(void *opaque, size_t size);
+typedef void (*szip_free_func)(void *opaque, void *ptr);
+
+/* blocksize 0 means the default of szip (-b17); order 0 (BWT), 3-255;     */
+/* recordsize 1-127, plus 0x80 for incremental (-i); NULL on bad arguments */
+/* or if there is not enough memory                                        */
+szip_stream *szip_compress_init(size_t blocksize, int order, int recordsize);
+
+/* the same with the memory from allocfn and freefn (both NULL: malloc) */
+szip_stream *szip_compress_init_alloc(size_t blocksize, int order, int recordsize,
+    szip_alloc_func allocfn, szip_free_func freefn, void *opaque);
+
+int szip_compress_stream(szip_stream *s, const unsigned char **in, size_t *inlen,
+    unsigned char **out, size_t *outcap, int flush);
+
+szip_stream *szip_decompress_init(void);
+
+szip_stream *szip_decompress_init_alloc(szip_alloc_func allocfn, szip_free_func freefn,
+    void *opaque);
+
+/* flush: SZIP_FINISH tells that all input is given; without it the end */
+/* of the stream cannot be told from a pause and SZIP_END never returns */
+int szip_decompress_stream(szip_stream *s, const unsigned char **in, size_t *inlen,
+    unsigned char **out, size_t *outcap, int flush);
+
+/* free a stream of either direction */
+void szip_end(szip_stream *s);
+
+/* a profile from the len bytes of a file written by szip --learn; */
+/* NULL if it is no profile or there is not enough memory          */
+szip_profile *szip_profile_load(const unsigned char *data, size_t len);
+
+void szip_profile_free(szip_profile *p);
+
+/* a compressor codes the blocks that follow with profile p (NULL: none); */
+/* a decompressor can then decode blocks coded with p, others with a      */
+/* profile give SZIP_DATA_ERROR. p must be kept until the stream ends     */
+int szip_set_profile(szip_stream *s, const szip_profile *p);
+
+/* the most bytes the compressor can make of len bytes (default blocksize) */
+size_t szip_bound(size_t len);
+
+/* compress in[i] (inlen[i] bytes) to out[i] (outcap[i] bytes) for i<n; */
+/* outlen[i] gets the bytes used, 0 if outcap[i] was too small (at most */
+/* szip_bound(inlen[i]) is needed). order and recordsize as for         */
+/* szip_compress_init, profile as for szip_set_profile (NULL: none).    */
+/* threads is the number of threads that code,                         */
+/* the caller included; 0 uses one per processor. Returns SZIP_OK or    */
+/* the first error; the buffers without error are coded anyway.         */
+int szip_compress_batch(size_t n, const unsigned char *const *in, const size_t *inlen,
+    unsigned char *const *out, const size_t *outcap, size_t *outlen,
+    int order, int recordsize, const szip_profile *profile, int threads);
+
+#endif
@@ -0,0 +1,242 @@
+/*  vecmodel.c     flat table probability model
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* Vecmodel is a drop-in alternative to bitmodel (with EXCLUDEONUPDATE)
+* that keeps only a flat array of frequencies. There is no cumulative
+* table to maintain, so updating, excluding and rescaling are cheap;
+* cumulative frequencies and symbol searches are computed on the fly
+* with SIMD prefix sums (SSE2 if available, plain C otherwise).
+* It produces exactly the same probabilities as bitmodel.
+*
+* The frequency array is padded to a multiple of VECLANES entries;
+* the padding is marked excluded and never contributes.
+*/
+
+#include "vecmodel.h"
+#include <stdio.h>     /* NULL */
+#include <stdlib.h>    /* malloc, free */
+#if defined __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define VECLANES 8     /* uint2 per 128 bit vector */
+#define VECPAD(n) (((n)+VECLANES-1) & ~(VECLANES-1))
+
+
+#if defined __SSE2__
+/* frequencies of v with excluded symbols set to 0 */
+static Inline __m128i vec_active(__m128i v)
+{   return _mm_andnot_si128(_mm_srai_epi16(v, 15), v);
+}
+
+/* inclusive prefix sum over the 8 lanes of v */
+static Inline __m128i vec_prefix(__m128i v)
+{   v = _mm_add_epi16(v, _mm_slli_si128(v, 2));
+    v = _mm_add_epi16(v, _mm_slli_si128(v, 4));
+    return _mm_add_epi16(v, _mm_slli_si128(v, 8));
+}
+#endif
+
+
+/* sum of the active frequencies of symbols 0..n-1 */
+static Inline int sumactive(uint2 *f, int n)
+{   int i, sum;
+#if defined __SSE2__
+    __m128i acc = _mm_setzero_si128();
+    for (i=0; i+VECLANES <= n; i+=VECLANES)
+        acc = _mm_add_epi16(acc, vec_active(_mm_loadu_si128((__m128i*)(f+i))));
+    acc = _mm_add_epi32(_mm_unpacklo_epi16(acc, _mm_setzero_si128()),
+                        _mm_unpackhi_epi16(acc, _mm_setzero_si128()));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+    sum = _mm_cvtsi128_si32(acc);
+#else
+    sum = 0;
+    i = 0;
+#endif
+    for (; i<n; i++)
+        if (!(f[i] & 0x8000))
+            sum += f[i];
+    return sum;
+}
+
+
+/* scales the frequencies by 0.5 and keeps nonzero values */
+static void scalefreq(vecmodel *m)
+{   uint2 *f, *endf;
+    STATCOUNT(m->rescales++);
+    f = m->f;
+    endf = f + VECPAD(m->n);
+#if defined __SSE2__
+    {   __m128i one = _mm_set1_epi16(1),
+            flag = _mm_set1_epi16((short)0x8000),
+            low = _mm_set1_epi16(0x7fff);
+        for (; f<endf; f+=VECLANES)
+        {   __m128i v = _mm_loadu_si128((__m128i*)f);
+            __m128i h = _mm_srli_epi16(_mm_add_epi16(_mm_and_si128(v, low), one), 1);
+            _mm_storeu_si128((__m128i*)f, _mm_or_si128(h, _mm_and_si128(v, flag)));
+        }
+    }
+#else
+    for (; f<endf; f++)
+        *f = ((1+(*f & 0x7fff))>>1) | (*f & 0x8000);
+#endif
+    m->totalfreq = sumactive(m->f, m->n);
+}
+
+
+/* update the total frequency by delta */
+static Inline void vec_totupd( vecmodel *m, int delta )
+{   m->totalfreq += delta;
+    if (m->totalfreq > m->max_totf)
+        scalefreq(m);
+}
+
+
+/* initialisation of vecmodel                          */
+/* m   vecmodel to be initialized                      */
+/* n   number of symbols in that model                 */
+/* max_totf  maximum allowed total frequency count     */
+/* rescale  desired rescaling interval, must be <max_totf/2 */
+/* init  array of int's to be used for initialisation (NULL ok) */
+void initvecmodel( vecmodel *m, int n, int max_totf, int rescale,
+    int *init )
+{   int i;
+    m->n = n;
+    if (max_totf < n<<1) max_totf = n<<1;
+    m->max_totf = max_totf;
+    m->incr = max_totf/2/rescale;
+    if (m->incr < 1) m->incr = 1;
+    m->f = (uint2*) malloc(VECPAD(n)*sizeof(uint2));
+    for (i=n; i<VECPAD(n); i++)
+        m->f[i] = 0x8000;
+    STATCOUNT(m->rescales = 0);
+    resetvecmodel(m,init);
+}
+
+
+/* reinitialisation of vecmodel                        */
+/* m   vecmodel to be initialized                      */
+/* init  array of int's to be used for initialisation (NULL ok) */
+void resetvecmodel( vecmodel *m, int *init)
+{   int i;
+    if (init == NULL)
+    {   for(i=0; i<m->n; i++)
+            m->f[i] = 1;
+        m->totalfreq = m->n;
+    } else
+    {   m->totalfreq = 0;
+        for(i=0; i<m->n; i++)
+        {   m->f[i] = init[i];
+            m->totalfreq += init[i];
+        }
+    }
+    while (m->totalfreq > m->max_totf)
+        scalefreq(m);
+    m->totalfreq = sumactive(m->f, m->n);
+}
+
+
+/* deletion of vecmodel m                              */
+void deletevecmodel( vecmodel *m )
+{   free(m->f);
+    m->n = 0;
+}
+
+
+/* retrieval of estimated frequencies for a symbol     */
+/* m   vecmodel to be questioned                       */
+/* sym  symbol for which data is desired; must be <n   */
+/* sy_f frequency of that symbol                       */
+/* lt_f frequency of all smaller symbols together      */
+/* the total frequency can be obtained with vectotf    */
+void vecgetfreq( vecmodel *m, int sym, int *sy_f, int *lt_f)
+{   *sy_f = m->f[sym];
+    *lt_f = sumactive(m->f, sym);
+}
+
+
+/* find out symbol for a given cumulative frequency    */
+/* m   vecmodel to be questioned                       */
+/* lt_f  cumulative frequency                          */
+int vecgetsym( vecmodel *m, int lt_f )
+{   uint2 *f = m->f;
+    int i, n = m->n;
+#if defined __SSE2__
+    /* unsigned compare of prefix sums with lt_f via the sign flip */
+    __m128i base = _mm_setzero_si128(),
+        sign = _mm_set1_epi16((short)0x8000),
+        key = _mm_set1_epi16((short)(lt_f ^ 0x8000));
+    for (i=0; i<n; i+=VECLANES)
+    {   __m128i v = vec_prefix(vec_active(_mm_loadu_si128((__m128i*)(f+i))));
+        int hit;
+        v = _mm_add_epi16(v, base);
+        hit = _mm_movemask_epi8(_mm_cmpgt_epi16(_mm_xor_si128(v, sign), key));
+        if (hit)
+        {   for (hit &= 0x5555; !(hit&1); hit >>= 2)
+                i++;
+            return i<n ? i : n-1;
+        }
+        base = _mm_shufflehi_epi16(v, 0xff);
+        base = _mm_unpackhi_epi64(base, base);
+    }
+#else
+    int cul = 0;
+    for (i=0; i<n; i++)
+        if (!(f[i] & 0x8000) && (cul += f[i]) > lt_f)
+            return i;
+#endif
+    return n-1;
+}
+
+
+/* update model                                        */
+/* m   vecmodel to be updated                          */
+/* sym  symbol that occurred (must be <n from init)    */
+void vecupdate( vecmodel *m, int sym )
+{   m->f[sym] += m->incr;
+    vec_totupd(m, m->incr);
+}
+
+
+/* update model and exclude symbol                     */
+/* m   vecmodel to be updated                          */
+/* sym  symbol that occurred (must be <n from init)    */
+void vecupdate_ex( vecmodel *m, int sym )
+{   int delta;
+    delta = -m->f[sym];
+    m->f[sym] = (m->f[sym] + m->incr) | 0x8000;
+    vec_totupd(m, delta);
+}
+
+
+/* deactivate symbol                                   */
+/* m   vecmodel to be updated                          */
+/* sym  symbol to be deactivated                       */
+void vecdeactivate( vecmodel *m, int sym )
+{   vec_totupd(m, -m->f[sym]);
+    m->f[sym] |= 0x8000;
+}
+
+
+/* reactivate symbol                                   */
+/* m   vecmodel to be updated                          */
+/* sym  symbol to be reactivated                       */
+void vecreactivate( vecmodel *m, int sym )
+{   m->f[sym] &= 0x7fff;
+    vec_totupd(m, m->f[sym]);
+}
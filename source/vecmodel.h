@@ -0,0 +1,104 @@
+/*  vecmodel.h     headerfile for flat table probability model
+*
+* Copyright 1997,1998,2021 Michael Schindler michael@compressconsult.com
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+*
+* Vecmodel is a drop-in alternative to bitmodel (with EXCLUDEONUPDATE)
+* that keeps only a flat array of frequencies. There is no cumulative
+* table to maintain, so updating, excluding and rescaling are cheap;
+* cumulative frequencies and symbol searches are computed on the fly
+* with SIMD prefix sums (SSE2 if available, plain C otherwise).
+* It produces exactly the same probabilities as bitmodel.
+*
+* As in bitmodel the high bit of a frequency marks an excluded symbol,
+* and the total frequency must stay below 1<<16.
+*/
+#ifndef VECMODEL_H
+#define VECMODEL_H
+
+
+#include "port.h"
+
+typedef struct {
+    int n,             /* number of symbols */
+        totalfreq,     /* total frequency count (without excluded symbols) */
+        max_totf,      /* maximum allowed total frequency count */
+        incr;          /* increment per update */
+    uint2 *f;          /* frequency for the symbol; first bit set if excluded */
+#ifdef SZSTATS
+    uint4 rescales;    /* number of rescales */
+#endif
+} vecmodel;
+
+/* initialisation of vecmodel                          */
+/* m   vecmodel to be initialized                      */
+/* n   number of symbols in that model                 */
+/* max_totf  maximum allowed total frequency count     */
+/* rescale  desired rescaling interval, must be <max_totf/2 */
+/* init  array of int's to be used for initialisation (NULL ok) */
+void initvecmodel( vecmodel *m, int n, int max_totf, int rescale,
+   int *init );
+
+/* reinitialisation of vecmodel                        */
+/* m   vecmodel to be initialized                      */
+/* init  array of int's to be used for initialisation (NULL ok) */
+void resetvecmodel( vecmodel *m, int *init);
+
+
+/* deletion of vecmodel m                              */
+void deletevecmodel( vecmodel *m );
+
+
+/* retrieval of estimated frequencies for a symbol     */
+/* m   vecmodel to be questioned                       */
+/* sym  symbol for which data is desired; must be <n   */
+/* sy_f frequency of that symbol                       */
+/* lt_f frequency of all smaller symbols together      */
+/* the total frequency can be obtained with vectotf    */
+void vecgetfreq( vecmodel *m, int sym, int *sy_f, int *lt_f);
+
+/* find out total frequency for a vecmodel             */
+/* m   vecmodel to be questioned                       */
+#define vectotf(m) ((m)->totalfreq)
+
+/* find out symbol for a given cumulative frequency    */
+/* m   vecmodel to be questioned                       */
+/* lt_f  cumulative frequency                          */
+int vecgetsym( vecmodel *m, int lt_f );
+
+
+/* update model                                        */
+/* m   vecmodel to be updated                          */
+/* sym  symbol that occurred (must be <n from init)    */
+void vecupdate( vecmodel *m, int sym );
+
+
+/* update model and exclude symbol                     */
+/* m   vecmodel to be updated                          */
+/* sym  symbol that occurred (must be <n from init)    */
+void vecupdate_ex( vecmodel *m, int sym );
+
+
+/* deactivate symbol                                   */
+/* m   vecmodel to be updated                          */
+/* sym  symbol to be deactivated                       */
+void vecdeactivate( vecmodel *m, int sym );
+
+/* reactivate symbol                                   */
+/* m   vecmodel to be updated                          */
+/* sym  symbol to be reactivated                       */
+void vecreactivate( vecmodel *m, int sym );
+
+#endif